@@ -5,41 +5,146 @@
 #include "DataManager.h"
 #include "CommandManager.h"
 
+#include <cstring>
 #include <utility>
+#include <algorithm>
 namespace domp {
   CommandManager::CommandManager(int clusterSize) {
     this->clusterSize = clusterSize;
     for(int i = 0; i < clusterSize; i++) {
       tagvalues[i] = DOMP_MIN_DATA_TAG;
-      commandMap[i] = new list<DOMPDataCommand_t*>();
     }
+    sendLoad.assign(clusterSize, 0);
+    commandMap.resize(clusterSize);
+    numTransfers = 0;
   }
   CommandManager::~CommandManager() {
-    // TO ensure the memory is freed
-    ReInitialize();
-    for(int i = 0; i < clusterSize; i++) {
-      delete(commandMap[i]);
-    }
   }
   std::pair<char *, int> CommandManager::GetCommands(int rank) {
-    list<DOMPDataCommand_t *> *commandList = commandMap[rank];
-    int size = commandList->size() * sizeof(DOMPDataCommand_t);
-    char *buffer = new char[size];
-    int i = 0;
-    for(std::list<DOMPDataCommand_t*>::iterator it = commandList->begin(); it != commandList->end(); ++it) {
-     memcpy(buffer + i * sizeof(DOMPDataCommand_t), *it, sizeof(DOMPDataCommand_t));
-     i++;
-    }
-    return std::make_pair(buffer, size);
+    std::vector<DOMPDataCommand_t> &commandList = commandMap[rank];
+    int size = commandList.size() * sizeof(DOMPDataCommand_t);
+    return std::make_pair(reinterpret_cast<char *>(commandList.data()), size);
   };
-  void CommandManager::InsertCommand(char* varName, int start, int size, int source, int destination) {
-    DOMPDataCommand_t* destinationCommand = new DOMPDataCommand_t();
-    DOMPDataCommand_t* sourceCommand = new DOMPDataCommand_t();
-
-    strncpy(destinationCommand->varName, varName, DOMP_MAX_VAR_NAME);
-    strncpy(sourceCommand->varName, varName, DOMP_MAX_VAR_NAME);
-    destinationCommand->size = sourceCommand->size = size;
-    destinationCommand->start = sourceCommand->start = start;
+  static unsigned int hashTransfer(const char *varName, int start, int size, int count, int stride, int source) {
+    // FNV-1a over the name and the numbers, then the final mix of MurmurHash3 so the low bits depend on all of them
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < DOMP_MAX_VAR_NAME && varName[i] != 0; i++) {
+      hash = (hash ^ (unsigned char) varName[i]) * 16777619u;
+    }
+    int values[] = {start, size, count, stride, source};
+    for (int i = 0; i < 5; i++) {
+      hash = (hash ^ (unsigned int) values[i]) * 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+  }
+
+  int CommandManager::findTransfer(const char *varName, int start, int size, int count, int stride, int source) {
+    unsigned int mask = transferIndex.size() - 1;
+    unsigned int slot = hashTransfer(varName, start, size, count, stride, source) & mask;
+    for (; !transferIndex.empty() && transferIndex[slot] != -1; slot = (slot + 1) & mask) {
+      Transfer_t &transfer = transfers[transferIndex[slot]];
+      if (transfer.start == start && transfer.size == size && transfer.count == count && transfer.stride == stride &&
+          transfer.source == source && strncmp(transfer.varName, varName, DOMP_MAX_VAR_NAME) == 0) {
+        return transferIndex[slot];
+      }
+    }
+
+    if ((unsigned int) (numTransfers + 1) * 2 > transferIndex.size()) {
+      // Grow and index the transfers again. Only happens when a sync needs more transfers than all the earlier ones
+      transferIndex.assign(std::max((size_t) 64, transferIndex.size() * 2), -1);
+      mask = transferIndex.size() - 1;
+      for (int i = 0; i < numTransfers; i++) {
+        Transfer_t &transfer = transfers[i];
+        unsigned int free = hashTransfer(transfer.varName, transfer.start, transfer.size, transfer.count,
+                                         transfer.stride, transfer.source) & mask;
+        while (transferIndex[free] != -1) free = (free + 1) & mask;
+        transferIndex[free] = i;
+      }
+      slot = hashTransfer(varName, start, size, count, stride, source) & mask;
+      while (transferIndex[slot] != -1) slot = (slot + 1) & mask;
+    }
+
+    if (numTransfers == (int) transfers.size()) {
+      transfers.push_back(Transfer_t());
+    }
+    Transfer_t &transfer = transfers[numTransfers];
+    strncpy(transfer.varName, varName, DOMP_MAX_VAR_NAME - 1);
+    transfer.varName[DOMP_MAX_VAR_NAME - 1] = 0;
+    transfer.start = start;
+    transfer.size = size;
+    transfer.count = count;
+    transfer.stride = stride;
+    transfer.source = source;
+    transfer.sources.clear();
+    transfer.destinations.clear();
+    transfer.collective = false;
+    transferIndex[slot] = numTransfers;
+    return numTransfers++;
+  }
+
+  void CommandManager::clearTransfers() {
+    if (numTransfers > 0) {
+      std::fill(transferIndex.begin(), transferIndex.end(), -1);
+    }
+    numTransfers = 0;
+  }
+
+  void CommandManager::InsertCommand(char* varName, int start, int size, int source, int destination, int count,
+                                     int stride) {
+    int index = findTransfer(varName, start, size, count, stride, source);
+    transfers[index].destinations.push_back(destination);
+    sendLoad[source] += (long) size * count;
+  }
+
+  void CommandManager::InsertFetch(char* varName, int start, int size, const std::vector<int> &sources,
+                                   int destination, int count, int stride) {
+    // Requests of the same data see the same holders, the directory only changes them after the reads of a sync
+    int index = findTransfer(varName, start, size, count, stride, DOMP_INVALID_NODE);
+    Transfer_t &transfer = transfers[index];
+    if (transfer.destinations.empty()) {
+      transfer.sources.assign(sources.begin(), sources.end());
+    }
+    transfer.destinations.push_back(destination);
+  }
+
+  void CommandManager::Merge(CommandManager *other) {
+    for (int i = 0; i < other->numTransfers; i++) {
+      Transfer_t &transfer = other->transfers[i];
+      for (unsigned int d = 0; d < transfer.destinations.size(); d++) {
+        int source = transfer.source;
+        if (source == DOMP_INVALID_NODE) {
+          for (unsigned int s = 0; s < transfer.sources.size(); s++) {
+            int candidate = transfer.sources[s];
+            if (source == DOMP_INVALID_NODE || sendLoad[candidate] < sendLoad[source]) source = candidate;
+          }
+        }
+        InsertCommand(transfer.varName, transfer.start, transfer.size, source, transfer.destinations[d],
+                      transfer.count, transfer.stride);
+      }
+    }
+    other->ReInitialize();
+  }
+
+  void CommandManager::createCommands(Transfer_t *transfer, int source, int destination, int phase) {
+    commandMap[source].push_back(DOMPDataCommand_t());
+    DOMPDataCommand_t* sourceCommand = &commandMap[source].back();
+    commandMap[destination].push_back(DOMPDataCommand_t());
+    DOMPDataCommand_t* destinationCommand = &commandMap[destination].back();
+
+    strncpy(destinationCommand->varName, transfer->varName, DOMP_MAX_VAR_NAME - 1);
+    destinationCommand->varName[DOMP_MAX_VAR_NAME - 1] = 0;
+    strncpy(sourceCommand->varName, transfer->varName, DOMP_MAX_VAR_NAME - 1);
+    sourceCommand->varName[DOMP_MAX_VAR_NAME - 1] = 0;
+    destinationCommand->size = sourceCommand->size = transfer->size;
+    destinationCommand->start = sourceCommand->start = transfer->start;
+    destinationCommand->count = sourceCommand->count = transfer->count;
+    destinationCommand->stride = sourceCommand->stride = transfer->stride;
+    destinationCommand->phase = sourceCommand->phase = phase;
     destinationCommand->nodeId = source;
     sourceCommand->nodeId = destination;
 
@@ -48,21 +153,168 @@ namespace domp {
 
     int myTag = tagvalues[destination]++;
     sourceCommand->tagValue = destinationCommand->tagValue = myTag;
+  }
+
+  // Piece of every node in a collective. Adjacent ranges of the same node are merged, returns false for others
+  static bool addPiece(std::vector<std::pair<int, int> > &pieces, int node, int start, int size) {
+    std::pair<int, int> &piece = pieces[node];
+    if (piece.second == 0) {
+      piece = std::make_pair(start, size);
+    } else if (piece.first + piece.second == start) {
+      piece.second += size;
+    } else if (start + size == piece.first) {
+      piece.first = start;
+      piece.second += size;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // Number of nodes with a piece, or zero if pieces overlap
+  int CommandManager::countPieces(const std::vector<std::pair<int, int> > &pieces) {
+    sortedPieces.assign(pieces.begin(), pieces.end());
+    std::sort(sortedPieces.begin(), sortedPieces.end());
+    int count = 0, end = 0;
+    for (unsigned int i = 0; i < sortedPieces.size(); i++) {
+      if (sortedPieces[i].second == 0) continue;
+      if (count > 0 && sortedPieces[i].first < end) return 0;
+      end = sortedPieces[i].first + sortedPieces[i].second;
+      count++;
+    }
+    return count;
+  }
+
+  // Every node gets a header followed by the piece of every node, so they all call the collectives in the same order
+  void CommandManager::createCollective(int commandType, int root, const char *varName,
+                                        const std::vector<std::pair<int, int> > &pieces,
+                                        const std::vector<int> &used) {
+    log("MASTER:: Collective[%d] Var[%s] Root[%d] replaces %d transfers", commandType, varName, root, (int) used.size());
+    for (unsigned int i = 0; i < used.size(); i++) {
+      transfers[used[i]].collective = true;
+    }
+    for (int node = 0; node < clusterSize; node++) {
+      commandMap[node].push_back(DOMPDataCommand_t());
+      DOMPDataCommand_t* header = &commandMap[node].back();
+      strncpy(header->varName, varName, DOMP_MAX_VAR_NAME - 1);
+      header->varName[DOMP_MAX_VAR_NAME - 1] = 0;
+      header->commandType = (MPICommandType) commandType;
+      header->nodeId = root;
+      header->count = clusterSize;
+      for (int part = 0; part < clusterSize; part++) {
+        commandMap[node].push_back(DOMPDataCommand_t());
+        DOMPDataCommand_t* piece = &commandMap[node].back();
+        strncpy(piece->varName, varName, DOMP_MAX_VAR_NAME - 1);
+        piece->varName[DOMP_MAX_VAR_NAME - 1] = 0;
+        piece->commandType = MPI_DATA_PIECE;
+        piece->nodeId = part;
+        piece->start = pieces[part].first;
+        piece->size = pieces[part].second;
+        piece->count = 1;
+      }
+    }
+  }
 
+  void CommandManager::recognizeCollectives() {
+    // Tiles are left to point to point commands. The others are grouped by variable name, each group in insertion order
+    candidates.clear();
+    for (int i = 0; i < numTransfers; i++) {
+      if (transfers[i].count == 1) candidates.push_back(i);
+    }
+    std::vector<Transfer_t> &all = transfers;
+    std::sort(candidates.begin(), candidates.end(), [&all](int a, int b) {
+      int order = strncmp(all[a].varName, all[b].varName, DOMP_MAX_VAR_NAME);
+      return (order != 0) ? order < 0 : a < b;
+    });
+
+    for (unsigned int first = 0, last = 0; first < candidates.size(); first = last) {
+      const char *varName = transfers[candidates[first]].varName;
+      while (last < candidates.size() &&
+             strncmp(transfers[candidates[last]].varName, varName, DOMP_MAX_VAR_NAME) == 0) {
+        last++;
+      }
 
-    commandMap[source]->push_back(sourceCommand);
-    commandMap[destination]->push_back(destinationCommand);
+      // All-gather, the piece of every node goes to all the other nodes
+      if (clusterSize > 2) {
+        pieces.assign(clusterSize, std::make_pair(0, 0));
+        used.clear();
+        bool valid = true;
+        for (unsigned int i = first; i < last; i++) {
+          Transfer_t *transfer = &transfers[candidates[i]];
+          if ((int) transfer->destinations.size() != clusterSize - 1) continue;
+          used.push_back(candidates[i]);
+          valid = valid && addPiece(pieces, transfer->source, transfer->start, transfer->size);
+        }
+        if (valid && used.size() >= 2 && countPieces(pieces) == (int) used.size()) {
+          createCollective(MPI_DATA_ALLGATHER, DOMP_INVALID_NODE, varName, pieces, used);
+        }
+      }
+
+      // Scatter from root and gather to root. Only single destination transfers, the others are broadcasts
+      for (int root = 0; root < clusterSize; root++) {
+        scatterPieces.assign(clusterSize, std::make_pair(0, 0));
+        gatherPieces.assign(clusterSize, std::make_pair(0, 0));
+        scatterUsed.clear();
+        gatherUsed.clear();
+        bool scatterValid = true, gatherValid = true;
+        for (unsigned int i = first; i < last; i++) {
+          Transfer_t *transfer = &transfers[candidates[i]];
+          if (transfer->collective || transfer->destinations.size() != 1) continue;
+          if (transfer->source == root) {
+            scatterUsed.push_back(candidates[i]);
+            scatterValid = scatterValid && addPiece(scatterPieces, transfer->destinations[0], transfer->start,
+                                                    transfer->size);
+          }
+          if (transfer->destinations[0] == root) {
+            gatherUsed.push_back(candidates[i]);
+            gatherValid = gatherValid && addPiece(gatherPieces, transfer->source, transfer->start, transfer->size);
+          }
+        }
+        if (scatterValid && countPieces(scatterPieces) >= DOMP_COLLECTIVE_MIN_NODES) {
+          createCollective(MPI_DATA_SCATTER, root, varName, scatterPieces, scatterUsed);
+        }
+        if (gatherValid && countPieces(gatherPieces) >= DOMP_COLLECTIVE_MIN_NODES) {
+          createCollective(MPI_DATA_GATHER, root, varName, gatherPieces, gatherUsed);
+        }
+      }
+    }
+  }
+
+  void CommandManager::Schedule() {
+    recognizeCollectives();
+    for (int t = 0; t < numTransfers; t++) {
+      Transfer_t *transfer = &transfers[t];
+      if (transfer->collective) continue;
+      int numDestinations = transfer->destinations.size();
+      if (numDestinations < DOMP_TREE_MIN_DESTINATIONS) {
+        for (int i = 0; i < numDestinations; i++) {
+          createCommands(transfer, transfer->source, transfer->destinations[i], 0);
+        }
+        continue;
+      }
+      // Binomial tree. In phase p, each of the first 2^p participants forwards to the one 2^p places after it
+      log("MASTER:: Tree broadcast Var[%s], Start[%d], Size[%d] from node %d to %d nodes", transfer->varName,
+          transfer->start, transfer->size, transfer->source, numDestinations);
+      participants.clear();
+      participants.push_back(transfer->source);
+      participants.insert(participants.end(), transfer->destinations.begin(), transfer->destinations.end());
+      int total = participants.size();
+      for (int phase = 0, holders = 1; holders < total; phase++, holders *= 2) {
+        for (int i = 0; i < holders && i + holders < total; i++) {
+          createCommands(transfer, participants[i], participants[i + holders], phase);
+        }
+      }
+    }
+    clearTransfers();
   }
 
   void CommandManager::ReInitialize() {
     // Reinitialize the datastructure now
     for(int i = 0; i < clusterSize; i++) {
       tagvalues[i] = DOMP_MIN_DATA_TAG;
-      list<DOMPDataCommand_t *> *commandList = commandMap[i];
-      for(std::list<DOMPDataCommand_t*>::iterator it = commandList->begin(); it != commandList->end(); it++) {
-        delete(*it);
-      }
-      commandMap[i]->clear();
+      sendLoad[i] = 0;
+      commandMap[i].clear();
     }
+    clearTransfers();
   }
 }
\ No newline at end of file
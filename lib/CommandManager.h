@@ -8,6 +8,7 @@
 #include <list>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "domp.h"
 
@@ -17,26 +18,92 @@ namespace domp {
   class CommandManager;
   class DOMPDataCommand;
 
-  enum MPIAccessType {MPI_SHARED_FETCH= 0, MPI_EXCLUSIVE_FETCH, MPI_SHARED_FIRST, MPI_EXCLUSIVE_FIRST};
+  // MPI_SET_PROTOCOL is not an access, its start carries the DOMP_PROTOCOL of the variable
+  enum MPIAccessType {MPI_SHARED_FETCH= 0, MPI_EXCLUSIVE_FETCH, MPI_SHARED_FIRST, MPI_EXCLUSIVE_FIRST, MPI_SET_PROTOCOL};
   typedef struct DOMPMapCommand {
       char varName[DOMP_MAX_VAR_NAME];
       int start;
       int size;
       MPIAccessType accessType;
       int nodeId;
+      // Tile requests are count rows of size elements, stride elements apart. Count is 1 for a contiguous range
+      int count;
+      int stride;
     } DOMPMapCommand_t;
 }
 
+// A fetch of the same data from one source by at least this many nodes is sent as a binomial tree
+#define DOMP_TREE_MIN_DESTINATIONS (3)
+// Disjoint ranges of one variable going from one node to at least this many nodes (or the opposite) are sent with
+// MPI_Scatterv (MPI_Gatherv)
+#define DOMP_COLLECTIVE_MIN_NODES (3)
+
 class domp::CommandManager {
-  std::map<int, std::list<DOMPDataCommand*>*> commandMap;
+  typedef struct Transfer {
+    char varName[DOMP_MAX_VAR_NAME];
+    int start;
+    int size;
+    int count;
+    int stride;
+    // DOMP_INVALID_NODE until Merge picks one of sources
+    int source;
+    std::vector<int> sources;
+    // Keep their capacity when the transfer is reused in a later sync
+    std::vector<int> destinations;
+    // Part of a collective, no point to point commands are needed
+    bool collective;
+  } Transfer_t;
+
+  // Commands of every node, stored by value. The vectors keep their capacity between syncs
+  std::vector<std::vector<DOMPDataCommand> > commandMap;
   std::map<int, int> tagvalues;
+  // Elements every node has to send in current sync
+  std::vector<long> sendLoad;
+  // The first numTransfers are the transfers of current sync, fetches of the same data from the same source are
+  // merged. The others are kept for the next syncs, so a sync needing no more transfers than an earlier one allocates
+  // nothing
+  std::vector<Transfer_t> transfers;
+  int numTransfers;
+  // Open addressing table of indices into transfers, -1 when free. Its size is a power of two, at least twice the
+  // number of transfers
+  std::vector<int> transferIndex;
+  // Scratch of recognizeCollectives and Schedule, kept between syncs
+  std::vector<int> candidates;
+  std::vector<int> used;
+  std::vector<int> scatterUsed;
+  std::vector<int> gatherUsed;
+  std::vector<std::pair<int, int> > pieces;
+  std::vector<std::pair<int, int> > scatterPieces;
+  std::vector<std::pair<int, int> > gatherPieces;
+  std::vector<std::pair<int, int> > sortedPieces;
+  std::vector<int> participants;
   int clusterSize;
 
+  // Index of the transfer with this data and source, added without destinations if there is none
+  int findTransfer(const char *varName, int start, int size, int count, int stride, int source);
+  void clearTransfers();
+  void createCommands(Transfer_t *transfer, int source, int destination, int phase);
+  int countPieces(const std::vector<std::pair<int, int> > &pieces);
+  void recognizeCollectives();
+  void createCollective(int commandType, int root, const char *varName, const std::vector<std::pair<int, int> > &pieces,
+                        const std::vector<int> &used);
+
  public:
   CommandManager(int clusterSize);
   ~CommandManager();
+  // Commands of a node as they are stored, valid until ReInitialize
   std::pair<char *, int> GetCommands(int rank);
-  void InsertCommand(char* varName, int start, int size, int source, int destination);
+  void InsertCommand(char* varName, int start, int size, int source, int destination, int count = 1, int stride = 0);
+  // Transfer that any of sources can serve. The source is left to Merge, so that the variables can be mapped in
+  // parallel and still pick on the load of the whole sync
+  void InsertFetch(char* varName, int start, int size, const std::vector<int> &sources, int destination, int count = 1,
+                   int stride = 0);
+  // Insert the transfers collected by another manager, in the order they were inserted there, and clear them there.
+  // Every destination of a transfer without a source gets the least loaded of its sources here, so the picks only
+  // depend on the merge order
+  void Merge(CommandManager *other);
+  // Turn the transfers into data commands. Must be called once all the commands of a sync are inserted
+  void Schedule();
   void ReInitialize();
 };
 
@@ -6,212 +6,540 @@
 
 #include "DataManager.h"
 #include "CommandManager.h"
+#include "Tracer.h"
 #include <mpi.h>
+#include <sched.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <atomic>
 using namespace domp;
 namespace domp {
+  // Tells the queues of a new data manager apart from the ones a thread cached for an older one
+  static std::atomic<int> instanceCounter(0);
+
+  // Adds the time of a scope to the blocked time of the sync, for the imbalance profiler
+  class BlockedScope {
+    double *total;
+    double start;
+   public:
+    explicit BlockedScope(double *total) : total(total) {
+#if PROFILING
+      start = currentSeconds();
+#endif
+    }
+    ~BlockedScope() {
+#if PROFILING
+      *total += currentSeconds() - start;
+#endif
+    }
+  };
 
   DataManager::DataManager(DOMP *dompObject, int clusterSize, int rank) {
     this->dompObject = dompObject;
     this->clusterSize = clusterSize;
     this->rank = rank;
     MPI_Comm_dup(MPI_COMM_WORLD, &mpi_comm);
+    // Both ends of a transfer split it the same way, so the master decides for all the nodes
+    int bytes = DOMP_DEFAULT_CHUNK_SIZE;
+    const char *chunkEnv = getenv("DOMP_CHUNK_SIZE");
+    if (rank == 0 && chunkEnv != NULL) {
+      bytes = atoi(chunkEnv);
+    }
+    MPI_Bcast(&bytes, 1, MPI_INT, 0, mpi_comm);
+    setChunkSize(bytes);
+    chunkHook = NULL;
+    chunkHookArg = NULL;
+    instanceId = instanceCounter++;
+    peerStats.assign(clusterSize, DOMPCommStats_t());
+    blockedTime = 0;
+  }
+
+  void DataManager::setChunkSize(int chunkSize) {
+    this->chunkSize = (chunkSize > 0) ? chunkSize : 0;
+  }
+
+  void DataManager::setChunkHook(DOMP_CHUNK_HOOK hook, void *arg) {
+    chunkHook = hook;
+    chunkHookArg = arg;
   }
 
   DataManager::~DataManager() {
     MPI_Comm_free(&mpi_comm);
   }
 
+  MasterDataManager::MasterDataManager(DOMP *dompObject, int clusterSize, int rank)
+      : DataManager(dompObject, clusterSize, rank) {
+    commandManager =  new CommandManager(clusterSize);
+    // The pool threads share the cores this node was bound to
+    int cores = (int) std::thread::hardware_concurrency();
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+      cores = CPU_COUNT(&mask);
+    }
+    int numThreads = std::min(cores, DOMP_MAX_MAPPING_THREADS);
+    const char *threadsEnv = getenv("DOMP_MAPPING_THREADS");
+    if (threadsEnv != NULL) {
+      numThreads = atoi(threadsEnv);
+    }
+    mappingPool = (numThreads > 1) ? new ThreadPool(numThreads) : NULL;
+    log("MASTER::Mapping with %d threads", mappingPool != NULL ? mappingPool->Size() : 1);
+  }
+
   MasterDataManager::~MasterDataManager() {
+    delete(mappingPool);
     // Free the memory for variables
     for (std::map<std::string,MasterVariable*>::iterator it=varList.begin(); it!=varList.end(); ++it)
       delete(it->second);
     delete(commandManager);
   }
 
-  void DataManager::requestData(std::string varName, int start, int size, MPIAccessType accessType) {
+  void MasterVariable::mapCommands() {
+    // Pushes of the update protocol go first, so that the reads of this phase find the copies current
+    if (getProtocol() == PROTOCOL_UPDATE) {
+      TraceScope trace(TRACE_MASTER_PUSH, varName);
+      pushUpdates(transfers, varName);
+    }
+
+    log("MASTER::Starting applying READ requests of Var[%s]", varName);
+    {
+      TraceScope trace(TRACE_MASTER_READ, varName, DOMP_INVALID_NODE, commands.size());
+      for (unsigned int i = 0; i < commands.size(); i++) {
+        log("MASTER::Applying READ command for nodeId %d", commands[i]->nodeId);
+        applyCommand(transfers, commands[i], DATA_PHASE_READ);
+      }
+    }
+
+    log("MASTER::Starting applying Update requests of Var[%s]", varName);
+    TraceScope trace(TRACE_MASTER_UPDATE, varName, DOMP_INVALID_NODE, commands.size());
+    // Reads first and writes last, so that a range written in this phase ends up owned by its writer and the copies
+    // read in the same phase are stale, whatever the order of arrival was
+    for (unsigned int i = 0; i < commands.size(); i++) {
+      if (commands[i]->accessType == MPI_EXCLUSIVE_FIRST) continue;
+      log("MASTER::Applying Update command for nodeId %d", commands[i]->nodeId);
+      applyCommand(transfers, commands[i], DATA_PHASE_UPDATE);
+    }
+    for (unsigned int i = 0; i < commands.size(); i++) {
+      if (commands[i]->accessType != MPI_EXCLUSIVE_FIRST) continue;
+      log("MASTER::Applying Update command for nodeId %d", commands[i]->nodeId);
+      applyCommand(transfers, commands[i], DATA_PHASE_UPDATE);
+    }
+    commands.clear();
+  }
+
+  void DataManager::requestData(std::string varName, int start, int size, MPIAccessType accessType, int count,
+                                int stride) {
     // Keep accumulating all data requests. Send it at once in triggerMap function() called when synchronize is called
-    // Thread-safety not required. Assuming that caller is calling this function sequentially
-    DOMPMapCommand_t *command = new DOMPMapCommand_t();
+    // Safe to call from several threads, each one appends to its own queue
+    std::vector<DOMPMapCommand_t> *queue = getThreadQueue();
+    queue->push_back(DOMPMapCommand_t());
+    DOMPMapCommand_t *command = &queue->back();
     strncpy(command->varName, varName.c_str(), varName.size());
     command->accessType = accessType;
     command->size = size;
     command->start = start;
+    command->count = count;
+    command->stride = stride;
     command->nodeId = rank;
-    mapRequest.push_back(command);
+    if (dompTracer != NULL) {
+      double now = currentSeconds();
+      dompTracer->Record(TRACE_REQUEST, command->varName, now, now, DOMP_INVALID_NODE, (long) size * count);
+    }
     log("Node %d:: Added request var[%s], start=%d, size=%d", rank, command->varName, start, size);
   }
 
+  std::vector<DOMPMapCommand_t> *DataManager::getThreadQueue() {
+    static thread_local std::vector<DOMPMapCommand_t> *queue = NULL;
+    static thread_local int queueOwner = -1;
+    if (queueOwner != instanceId) {
+      std::lock_guard<std::mutex> guard(queueLock);
+      threadQueues.push_back(std::vector<DOMPMapCommand_t>());
+      queue = &threadQueues.back();
+      queueOwner = instanceId;
+    }
+    return queue;
+  }
+
+  // Queues are merged in the order the threads first requested data, and keep their capacity for the next sync
+  void DataManager::collectRequests() {
+    std::lock_guard<std::mutex> guard(queueLock);
+    mapRequest.clear();
+    for (std::list<std::vector<DOMPMapCommand_t> >::iterator it = threadQueues.begin(); it != threadQueues.end();
+         ++it) {
+      mapRequest.insert(mapRequest.end(), it->begin(), it->end());
+      it->clear();
+    }
+    for (unsigned int i = 0; i < mapRequest.size(); i++) {
+      varStats[mapRequest[i].varName].mapCommands++;
+    }
+    // The master counts the requests of the other nodes as it receives them
+    if (rank != 0) peerStats[0].mapCommands += mapRequest.size();
+  }
+
+  void DataManager::countTransfer(const char *varName, int peer, bool sent, long bytes, int messages) {
+    DOMPCommStats_t *counters[2] = {&varStats[varName], &peerStats[peer]};
+    for (int i = 0; i < 2; i++) {
+      if (sent) {
+        counters[i]->bytesSent += bytes;
+        counters[i]->messagesSent += messages;
+        counters[i]->fragmentsSent++;
+      } else {
+        counters[i]->bytesReceived += bytes;
+        counters[i]->messagesReceived += messages;
+        counters[i]->fragmentsReceived++;
+      }
+    }
+  }
+
+  DOMPCommStats_t DataManager::getVariableStats(const std::string &varName) {
+    std::map<std::string, DOMPCommStats_t>::iterator it = varStats.find(varName);
+    return (it != varStats.end()) ? it->second : DOMPCommStats_t();
+  }
+
+  DOMPCommStats_t DataManager::getPeerStats(int node) {
+    return (node >= 0 && node < clusterSize) ? peerStats[node] : DOMPCommStats_t();
+  }
+
   void DataManager::handleMapResponse(char* buffer, int count) {
       int numRequests = count / sizeof(DOMPDataCommand_t);
       log("Node %d::Data request response received with %d requests.", rank, numRequests);
-      MPI_Request *requests = new MPI_Request[numRequests];
-      MPI_Status *status = new MPI_Status[numRequests];
+      tileTypes.clear();
+      int numPhases = 0;
       for(int i = 0; i < numRequests; i++) {
         DOMPDataCommand_t *command = reinterpret_cast<DOMPDataCommand_t *>(buffer + i *sizeof(DOMPDataCommand_t));
-        std::pair<char*, int> ret = dompObject->mapDataRequest(command->varName, command->start, command->size);
-        if (command->commandType == MPI_DATA_FETCH) {
-          log("Node %d::[%d] DATAFETCH Var[%s], start[%d], size[%d], bytes[%d], tag[%d] Address[%p] Node[%d]", rank, i,
-              command->varName, command->start, command->size, ret.second, command->tagValue, ret.first, command->nodeId);
-          // Wait for the data to receive
-          MPI_Irecv(ret.first, ret.second, MPI_BYTE, command->nodeId, command->tagValue, mpi_comm, &requests[i]);
-        }
-        else {
-          // Send the Data request to slave nodes. Use already created connection
-          log("Node %d::[%d] DATASEND Var[%s], start[%d], size[%d], bytes[%d], tag[%d] Address[%p] Node[%d]", rank, i,
-              command->varName, command->start, command->size, ret.second, command->tagValue, ret.first, command->nodeId);
-          MPI_Isend(ret.first, ret.second, MPI_BYTE, command->nodeId, command->tagValue, mpi_comm, &requests[i]);
-        }
+        if (command->commandType != MPI_DATA_FETCH && command->commandType != MPI_DATA_SEND) continue;
+        numPhases = std::max(numPhases, command->phase + 1);
       }
 
-      if(MPI_Waitall(numRequests , requests, status) == MPI_ERR_IN_STATUS) {
-        log("ERROR::Waitall failed");
+      // Forwarding nodes of a tree broadcast must receive the data before sending it on
+      for (int phase = 0; phase < numPhases; phase++) {
+        transfers.clear();
+        for(int i = 0; i < numRequests; i++) {
+          DOMPDataCommand_t *command = reinterpret_cast<DOMPDataCommand_t *>(buffer + i *sizeof(DOMPDataCommand_t));
+          if (command->phase != phase) continue;
+          if (command->commandType != MPI_DATA_FETCH && command->commandType != MPI_DATA_SEND) continue;
+          std::pair<char*, int> ret = dompObject->mapDataRequest(command->varName, command->start, command->size);
+          DOMPTransferState_t transfer;
+          transfer.command = command;
+          transfer.address = ret.first;
+          transfer.bytes = ret.second;
+          // Tiles are sent as a single message of strided rows
+          transfer.type = MPI_BYTE;
+          transfer.typeCount = ret.second;
+          transfer.numChunks = 1;
+          transfer.nextChunk = 0;
+          transfer.doneChunks = 0;
+          transfer.startTime = (dompTracer != NULL) ? currentSeconds() : 0;
+          if (command->count > 1 && command->size > 0) {
+            int varSize = ret.second / command->size;
+            MPI_Type_vector(command->count, ret.second, command->stride * varSize, MPI_BYTE, &transfer.type);
+            MPI_Type_commit(&transfer.type);
+            tileTypes.push_back(transfer.type);
+            transfer.typeCount = 1;
+          } else if (chunkSize > 0 && ret.second > chunkSize) {
+            transfer.numChunks = (ret.second + chunkSize - 1) / chunkSize;
+          }
+          log("Node %d::[%d] %s Var[%s], start[%d], size[%d], count[%d], bytes[%d], chunks[%d], tag[%d] Address[%p] "
+              "Node[%d] Phase[%d]", rank, i, command->commandType == MPI_DATA_FETCH ? "DATAFETCH" : "DATASEND",
+              command->varName, command->start, command->size, command->count, ret.second, transfer.numChunks,
+              command->tagValue, ret.first, command->nodeId, phase);
+          transfers.push_back(transfer);
+        }
+        runTransfers();
       }
 
+      // Collectives come last, every node has them in the same order
       for(int i = 0; i < numRequests; i++) {
+        DOMPDataCommand_t *command = reinterpret_cast<DOMPDataCommand_t *>(buffer + i *sizeof(DOMPDataCommand_t));
+        if (!IS_COLLECTIVE(command->commandType)) continue;
+        handleCollective(command, command + 1);
+        i += command->count;
+      }
+
+      for (unsigned int i = 0; i < tileTypes.size(); i++) {
+        MPI_Type_free(&tileTypes[i]);
+      }
+  }
+
+  void DataManager::postChunk(DOMPTransferState_t *transfer, int chunk, MPI_Request *request) {
+    DOMPDataCommand_t *command = transfer->command;
+    char *address = transfer->address;
+    int typeCount = transfer->typeCount;
+    if (transfer->numChunks > 1) {
+      address += (long) chunk * chunkSize;
+      typeCount = std::min(chunkSize, transfer->bytes - chunk * chunkSize);
+    }
+    if (command->commandType == MPI_DATA_FETCH) {
+      MPI_Irecv(address, typeCount, transfer->type, command->nodeId, command->tagValue, mpi_comm, request);
+    } else {
+      MPI_Isend(address, typeCount, transfer->type, command->nodeId, command->tagValue, mpi_comm, request);
+    }
+    transfer->nextChunk = chunk + 1;
+  }
+
+  // Keep up to DOMP_CHUNK_WINDOW chunks of every transfer in flight, and post the next one as soon as one completes
+  void DataManager::runTransfers() {
+    std::vector<MPI_Request> &requests = chunkRequests;
+    std::vector<std::pair<int, int> > &slots = chunkSlots;
+    requests.clear();
+    slots.clear();
+    for (unsigned int t = 0; t < transfers.size(); t++) {
+      int window = std::min(DOMP_CHUNK_WINDOW, transfers[t].numChunks);
+      for (int chunk = 0; chunk < window; chunk++) {
+        requests.push_back(MPI_REQUEST_NULL);
+        slots.push_back(std::make_pair(t, chunk));
+        postChunk(&transfers[t], chunk, &requests.back());
+      }
+    }
+    if (requests.empty()) return;
+
+    std::vector<int> &indices = chunkIndices;
+    std::vector<MPI_Status> &status = chunkStatus;
+    indices.resize(requests.size());
+    status.resize(requests.size());
+    while (true) {
+      int outcount;
+      MPI_Waitsome(requests.size(), &requests[0], &outcount, &indices[0], &status[0]);
+      if (outcount == MPI_UNDEFINED) break;
+      for (int i = 0; i < outcount; i++) {
+        int slot = indices[i];
+        DOMPTransferState_t *transfer = &transfers[slots[slot].first];
+        int chunk = slots[slot].second;
         if (status[i].MPI_ERROR != MPI_SUCCESS) {
-          log("Command with %d failed with error code %ld", i, status[i].MPI_ERROR);
+          log("Command with %d failed with error code %ld", slot, status[i].MPI_ERROR);
+        }
+        // Hooks only see contiguous data, not tiles
+        if (chunkHook != NULL && transfer->command->commandType == MPI_DATA_FETCH && transfer->type == MPI_BYTE) {
+          int offset = (transfer->numChunks > 1) ? chunk * chunkSize : 0;
+          int bytes = (transfer->numChunks > 1) ? std::min(chunkSize, transfer->bytes - offset) : transfer->bytes;
+          chunkHook(transfer->command->varName, transfer->address + offset, bytes, chunkHookArg);
+        }
+        if (transfer->nextChunk < transfer->numChunks) {
+          slots[slot].second = transfer->nextChunk;
+          postChunk(transfer, transfer->nextChunk, &requests[slot]);
         }
+        if (++transfer->doneChunks == transfer->numChunks) {
+          DOMPDataCommand_t *command = transfer->command;
+          bool sent = command->commandType == MPI_DATA_SEND;
+          // Tiles send bytes for every one of their rows
+          long bytes = (transfer->type == MPI_BYTE) ? transfer->bytes : (long) transfer->bytes * command->count;
+          countTransfer(command->varName, command->nodeId, sent, bytes, transfer->numChunks);
+          if (dompTracer != NULL) {
+            dompTracer->Record(sent ? TRACE_SEND : TRACE_FETCH, command->varName, transfer->startTime,
+                               currentSeconds(), command->nodeId, bytes);
+          }
+        }
+      }
+    }
+  }
+
+  void DataManager::handleCollective(DOMPDataCommand_t *header, DOMPDataCommand_t *pieces) {
+    TraceScope trace(TRACE_COLLECTIVE, header->varName, header->nodeId);
+    // Counts and displacements are in bytes from the start of the variable
+    char *base = dompObject->mapDataRequest(header->varName, 0, 0).first;
+    collectiveCounts.resize(clusterSize);
+    collectiveDispls.resize(clusterSize);
+    int *counts = &collectiveCounts[0];
+    int *displs = &collectiveDispls[0];
+    for (int i = 0; i < clusterSize; i++) {
+      std::pair<char*, int> ret = dompObject->mapDataRequest(header->varName, pieces[i].start, pieces[i].size);
+      counts[i] = ret.second;
+      displs[i] = ret.first - base;
+    }
+    int root = header->nodeId;
+    trace.setSize(counts[rank]);
+    log("Node %d::COLLECTIVE[%d] Var[%s], Root[%d], Count[%d]", rank, header->commandType, header->varName, root,
+        counts[rank]);
+
+    if (header->commandType == MPI_DATA_SCATTER) {
+      if (rank == root) {
+        MPI_Scatterv(base, counts, displs, MPI_BYTE, MPI_IN_PLACE, 0, MPI_BYTE, root, mpi_comm);
+      } else {
+        MPI_Scatterv(NULL, NULL, NULL, MPI_BYTE, base + displs[rank], counts[rank], MPI_BYTE, root, mpi_comm);
+      }
+    } else if (header->commandType == MPI_DATA_GATHER) {
+      if (rank == root) {
+        MPI_Gatherv(MPI_IN_PLACE, 0, MPI_BYTE, base, counts, displs, MPI_BYTE, root, mpi_comm);
+      } else {
+        MPI_Gatherv(base + displs[rank], counts[rank], MPI_BYTE, NULL, NULL, NULL, MPI_BYTE, root, mpi_comm);
       }
+    } else {
+      MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_BYTE, base, counts, displs, MPI_BYTE, mpi_comm);
+    }
 
-      delete(requests);
+    // Counted as the point to point messages the collective replaces
+    for (int node = 0; node < clusterSize; node++) {
+      if (node == rank) continue;
+      long sentBytes = 0, receivedBytes = 0;
+      if (header->commandType == MPI_DATA_SCATTER) {
+        if (rank == root) sentBytes = counts[node];
+        else if (node == root) receivedBytes = counts[rank];
+      } else if (header->commandType == MPI_DATA_GATHER) {
+        if (rank == root) receivedBytes = counts[node];
+        else if (node == root) sentBytes = counts[rank];
+      } else {
+        sentBytes = counts[rank];
+        receivedBytes = counts[node];
+      }
+      if (sentBytes > 0) countTransfer(header->varName, node, true, sentBytes, 1);
+      if (receivedBytes > 0) countTransfer(header->varName, node, false, receivedBytes, 1);
+    }
   }
 
   void DataManager::triggerMap() {
+    blockedTime = 0;
 
-    ssize_t  size = mapRequest.size() * sizeof(DOMPMapCommand_t);
-    char buffer[size];
-
-    std::list<DOMPMapCommand_t*>::iterator it;
-    int i = 0;
-    for (it = mapRequest.begin(); it != mapRequest.end(); ++it){
-      DOMPMapCommand_t *cmd = *it;
-      memcpy(&buffer[i * sizeof(DOMPMapCommand_t)], cmd, sizeof(DOMPMapCommand_t));
-      i++;
-      delete(cmd);
-    }
+    // Requests are already contiguous, send them as they are
+    int size = mapRequest.size() * sizeof(DOMPMapCommand_t);
 
     // Send the MAP request to Master node always. Use the already created connection
-    MPI_Send(buffer, size, MPI_BYTE, 0, MPI_MAP_REQ, mpi_comm);
+    {
+      TraceScope trace(TRACE_MAP_SEND, NULL, 0, size);
+      MPI_Send(mapRequest.data(), size, MPI_BYTE, 0, MPI_MAP_REQ, mpi_comm);
+    }
     // Clear the commands now
     mapRequest.clear();
 
     MPI_Status status;
-    MPI_Probe(0, MPI_MAP_RESP, mpi_comm, &status);
-
-    if (status.MPI_ERROR == MPI_SUCCESS && status.MPI_SOURCE == 0) {
-      int count;
+    int count = 0;
+    {
+      // Includes waiting for the master to map the requests of all the nodes
+      TraceScope trace(TRACE_MAP_RECV, NULL, 0);
+      probeMap(0, MPI_MAP_RESP, &status);
       MPI_Get_count(&status, MPI_BYTE, &count);
-      char *buffer = new char[count];
-      MPI_Recv(buffer, count, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, mpi_comm, NULL);
-      handleMapResponse(buffer, count);
-      delete(buffer);
+      responseBuffer.resize(count);
+      MPI_Recv(responseBuffer.data(), count, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, mpi_comm, NULL);
+      trace.setSize(count);
     }
+    handleMapResponse(responseBuffer.data(), count);
 
 
     // Synchronization is must here as all nodes should receive and send the shared data
+    TraceScope trace(TRACE_BARRIER);
+    BlockedScope blocked(&blockedTime);
     MPI_Barrier(MPI_COMM_WORLD);
   }
 
+  // MPI_Probe doesn't fill status->MPI_ERROR, so check the return code instead. Going on without the message would
+  // lose the requests of a node on the master, or the transfers of this node on a worker, and hang the others
+  void DataManager::probeMap(int source, int tag, MPI_Status *status) {
+    BlockedScope blocked(&blockedTime);
+    if (MPI_Probe(source, tag, mpi_comm, status) != MPI_SUCCESS) {
+      log("Node %d::Probe for map message with tag %d failed", rank, tag);
+      MPI_Abort(MPI_COMM_WORLD, DOMP_PROBE_FAILED);
+    }
+  }
+
   void MasterDataManager::triggerMap() {
+    blockedTime = 0;
     // Master node directly pushes its own command to the list
-    std::list<DOMPMapCommand_t*>::iterator it;
-    for (it = mapRequest.begin(); it != mapRequest.end(); ++it){
-      DOMPMapCommand_t *command = *it;
+    for (unsigned int i = 0; i < mapRequest.size(); i++) {
+      DOMPMapCommand_t *command = &mapRequest[i];
       log("MASTER::Received request Node[%d], varName[%s], start[%d], size[%d]",command->nodeId, command->varName,
           command->start, command->size);
-      commands_received.push_back(command);
     }
+    commands_received.assign(mapRequest.begin(), mapRequest.end());
 
     mapRequest.clear();
 
     log("MASTER::Starting receiving requests ");
     // Master doesn't send the request to itself. It waits for a message from all other nodes
-    MPI_Status status;
-    int requestReceived = 1;
-    while (requestReceived != clusterSize) {
-      MPI_Probe(MPI_ANY_SOURCE, MPI_MAP_REQ, mpi_comm, &status);
-      handleMapRequest(&status);
-      requestReceived++;
-    }
-    // Perform the mapping here
-
-    log("MASTER::Starting applying READ requests");
-    std::list<DOMPMapCommand_t*>::iterator commandIterator;
-    for(commandIterator = commands_received.begin(); commandIterator != commands_received.end(); ++commandIterator) {
-      DOMPMapCommand_t* command = *commandIterator;
-      if (0 == varList.count(std::string(command->varName))){
+    {
+      TraceScope trace(TRACE_MASTER_RECV);
+      MPI_Status status;
+      int requestReceived = 1;
+      while (requestReceived != clusterSize) {
+        probeMap(MPI_ANY_SOURCE, MPI_MAP_REQ, &status);
+        handleMapRequest(&status);
+        requestReceived++;
+      }
+      trace.setSize(commands_received.size() * sizeof(DOMPMapCommand_t));
+    }
+    // Perform the mapping here. Commands of different variables are independent, so every variable is mapped on its
+    // own, in the order its commands arrived
+    for (unsigned int i = 0; i < commands_received.size(); i++) {
+      DOMPMapCommand_t* command = &commands_received[i];
+      std::map<std::string, MasterVariable*>::iterator it = varList.find(command->varName);
+      if (it == varList.end()) {
         log("MASTER::Variable %s not found", command->varName);
         MPI_Abort(MPI_COMM_WORLD, DOMP_VAR_NOT_FOUND_ON_MASTER);
       }
-      log("MASTER::Applying READ command for nodeId %d", command->nodeId);
-      MasterVariable *masterVariable = varList[command->varName];
-      masterVariable->applyCommand(commandManager, command, DATA_PHASE_READ);
+      // Applied before any command of this sync is mapped
+      if (command->accessType == MPI_SET_PROTOCOL) {
+        it->second->setProtocol((DOMP_PROTOCOL) command->start);
+        continue;
+      }
+      it->second->addCommand(command);
+    }
+    activeVariables.clear();
+    for (std::map<std::string, MasterVariable*>::iterator it = varList.begin(); it != varList.end(); ++it) {
+      if (it->second->isActive()) activeVariables.push_back(it->second);
+    }
+    if (mappingPool != NULL && activeVariables.size() > 1) {
+      std::vector<MasterVariable*> &variables = activeVariables;
+      mappingPool->ParallelFor(variables.size(), [&variables](int i) { variables[i]->mapCommands(); });
+    } else {
+      for (unsigned int i = 0; i < activeVariables.size(); i++) {
+        activeVariables[i]->mapCommands();
+      }
+    }
+    // Merged in name order, which also picks the sources, so the commands don't depend on which thread finished first
+    for (unsigned int i = 0; i < activeVariables.size(); i++) {
+      commandManager->Merge(activeVariables[i]->getTransfers());
     }
 
-    log("MASTER::Starting applying Update requests");
-    for(commandIterator = commands_received.begin(); commandIterator != commands_received.end(); ++commandIterator) {
-      DOMPMapCommand_t* command = *commandIterator;
-      log("MASTER::Applying Update command for nodeId %d", command->nodeId);
-      MasterVariable *masterVariable = varList[command->varName];
-      masterVariable->applyCommand(commandManager, command, DATA_PHASE_UPDATE);
-      delete(command);
+    {
+      TraceScope trace(TRACE_MASTER_SCHEDULE);
+      commandManager->Schedule();
     }
 
     log("MASTER::Starting sending commands");
 
     int index = 1;
-    MPI_Request *requests = new MPI_Request[clusterSize - 1];
+    sendRequests.resize(clusterSize);
+    MPI_Request *requests = &sendRequests[0];
     while (index != clusterSize) {
       std::pair<char*, int> data = commandManager->GetCommands(index);
+      TraceScope trace(TRACE_MASTER_SEND, NULL, index, data.second);
       log("MASTER sending commands for size %d to nodeId %d", data.second/sizeof(DOMPDataCommand_t), index);
+      // Sent straight from the command lists, they stay untouched until ReInitialize
       MPI_Isend(data.first, data.second, MPI_BYTE, index, MPI_MAP_RESP, mpi_comm, &requests[index-1]);
       index++;
-      delete(data.first);
     }
-    MPI_Waitall(clusterSize - 1 , requests, MPI_STATUSES_IGNORE);
-    index = 1;
-    while (index != clusterSize) {
-      std::pair<char*, int> data = commandManager->GetCommands(index);
-      // Release the buffer
-      delete(data.first);
-      index++;
-    }
-    delete (requests);
     commands_received.clear();
 
     log("MASTER::Starting applying its own commands");
 
     // Process the commands for master node
     std::pair<char*, int> data = commandManager->GetCommands(rank);
-    char* buffer = data.first;
-    handleMapResponse(buffer, data.second);
-    delete(buffer);
+    handleMapResponse(data.first, data.second);
 
+    MPI_Waitall(clusterSize - 1 , requests, MPI_STATUSES_IGNORE);
     commandManager->ReInitialize();
 
     log("MASTER::Completed applying its own commands");
 
     // Synchronization is must here as all nodes should receive and send the shared data
+    TraceScope trace(TRACE_BARRIER);
+    BlockedScope blocked(&blockedTime);
     MPI_Barrier(MPI_COMM_WORLD);
   }
 
   void MasterDataManager::handleMapRequest(MPI_Status* status) {
-    if (status->MPI_ERROR == MPI_SUCCESS) {
-      int count;
-      MPI_Get_count(status, MPI_BYTE, &count);
-      char *buffer = new char[count];
-      MPI_Recv(buffer, count, MPI_BYTE, status->MPI_SOURCE, status->MPI_TAG, mpi_comm, NULL);
-      // Now process all requests one at a time
+    int count;
+    if (MPI_Get_count(status, MPI_BYTE, &count) == MPI_SUCCESS) {
+      // Receive straight behind the requests already collected in this sync
       int numRequests = count / sizeof(DOMPMapCommand_t);
+      int first = commands_received.size();
+      commands_received.resize(first + numRequests);
+      MPI_Recv(commands_received.data() + first, count, MPI_BYTE, status->MPI_SOURCE, status->MPI_TAG, mpi_comm, NULL);
       log("MASTER::Received %d requests from node %d", numRequests, status->MPI_SOURCE);
-      for (int i = 0; i < numRequests; i++) {
-        DOMPMapCommand_t *cmd = new DOMPMapCommand_t();
-        memcpy(cmd, buffer + i *sizeof(DOMPMapCommand_t), sizeof(DOMPMapCommand_t));
+      peerStats[status->MPI_SOURCE].mapCommands += numRequests;
+      for (int i = first; i < first + numRequests; i++) {
+        DOMPMapCommand_t *cmd = &commands_received[i];
         log("MASTER::Received request Node[%d], varName[%s], start[%d], size[%d]",status->MPI_SOURCE, cmd->varName,
             cmd->start, cmd->size);
-        commands_received.push_back(cmd);
       }
-      delete(buffer);
       log("MASTER::Added %d requests from node %d", numRequests, status->MPI_SOURCE);
     }
   }
@@ -220,12 +548,118 @@ namespace domp {
     // Do nothing on regular ndoes
   }
 
+  void DataManager::unregisterVariable(std::string varName) {
+    // Do nothing on regular nodes
+  }
+
+  void MasterDataManager::unregisterVariable(std::string varName) {
+    if (varList.count(varName) != 0) {
+      delete(varList[varName]);
+      varList.erase(varName);
+    }
+  }
+
+  // Only the master keeps the directory, so the change travels with the map requests of the next sync
+  void DataManager::setProtocol(std::string varName, DOMP_PROTOCOL protocol) {
+    requestData(varName, protocol, 0, MPI_SET_PROTOCOL);
+  }
+
+  DOMPCoherenceStats_t DataManager::getCoherenceStats(const std::string &varName) {
+    return CoherenceStats_t();
+  }
+
+  void DataManager::printStatistics() {
+  }
+
+  DOMPCoherenceStats_t MasterDataManager::getCoherenceStats(const std::string &varName) {
+    std::map<std::string, MasterVariable*>::iterator it = varList.find(varName);
+    return (it != varList.end()) ? it->second->getStats() : CoherenceStats_t();
+  }
+
+  void MasterDataManager::printStatistics() {
+    for (std::map<std::string, MasterVariable*>::iterator it = varList.begin(); it != varList.end(); ++it) {
+      const CoherenceStats_t &stats = it->second->getStats();
+      if (stats.hits + stats.misses + stats.invalidations + stats.updates == 0) continue;
+      printf("DOMP Var[%s] protocol = %s, invalidations = %ld, updates = %ld, update elements = %ld, hits = %ld, "
+             "misses = %ld, wasted updates = %ld\n", it->first.c_str(),
+             it->second->getProtocol() == PROTOCOL_UPDATE ? "update" : "invalidate", stats.invalidations,
+             stats.updates, stats.updateElements, stats.hits, stats.misses, stats.wasted);
+    }
+  }
+
+  typedef struct VariableTraffic {
+    char varName[DOMP_MAX_VAR_NAME];
+    DOMPCommStats_t stats;
+  } VariableTraffic_t;
+
+  void DataManager::printTraffic() {
+    // Nodes may have counters for different variables, so they are gathered by name
+    std::vector<VariableTraffic_t> local(varStats.size());
+    int count = 0;
+    for (std::map<std::string, DOMPCommStats_t>::iterator it = varStats.begin(); it != varStats.end(); ++it) {
+      strncpy(local[count].varName, it->first.c_str(), DOMP_MAX_VAR_NAME - 1);
+      local[count].varName[DOMP_MAX_VAR_NAME - 1] = 0;
+      local[count].stats = it->second;
+      count++;
+    }
+    int bytes = count * sizeof(VariableTraffic_t);
+    std::vector<int> counts(clusterSize), displs(clusterSize);
+    MPI_Gather(&bytes, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, mpi_comm);
+    std::vector<char> all;
+    if (rank == 0) {
+      int offset = 0;
+      for (int i = 0; i < clusterSize; i++) {
+        displs[i] = offset;
+        offset += counts[i];
+      }
+      all.resize(offset);
+    }
+    MPI_Gatherv(local.data(), bytes, MPI_BYTE, all.data(), &counts[0], &displs[0], MPI_BYTE, 0, mpi_comm);
+
+    // Row of every node is what it sent to the others
+    std::vector<long> sent(clusterSize);
+    for (int i = 0; i < clusterSize; i++) {
+      sent[i] = peerStats[i].bytesSent;
+    }
+    std::vector<long> matrix((rank == 0) ? clusterSize * clusterSize : 0);
+    MPI_Gather(sent.data(), clusterSize, MPI_LONG, matrix.data(), clusterSize, MPI_LONG, 0, mpi_comm);
+    if (rank != 0) return;
+
+    std::map<std::string, DOMPCommStats_t> totals;
+    for (unsigned int i = 0; i < all.size() / sizeof(VariableTraffic_t); i++) {
+      VariableTraffic_t *traffic = reinterpret_cast<VariableTraffic_t *>(&all[i * sizeof(VariableTraffic_t)]);
+      DOMPCommStats_t &total = totals[traffic->varName];
+      total.bytesSent += traffic->stats.bytesSent;
+      total.messagesSent += traffic->stats.messagesSent;
+      total.fragmentsSent += traffic->stats.fragmentsSent;
+      total.mapCommands += traffic->stats.mapCommands;
+    }
+    for (std::map<std::string, DOMPCommStats_t>::iterator it = totals.begin(); it != totals.end(); ++it) {
+      printf("DOMP Var[%s] bytes = %ld, messages = %ld, fragments = %ld, map commands = %ld\n", it->first.c_str(),
+             it->second.bytesSent, it->second.messagesSent, it->second.fragmentsSent, it->second.mapCommands);
+    }
+    printf("DOMP Traffic matrix in bytes, row = sender, column = receiver\n");
+    printf("%6s", "");
+    for (int j = 0; j < clusterSize; j++) printf(" %12d", j);
+    printf(" %12s\n", "total");
+    for (int i = 0; i < clusterSize; i++) {
+      long rowTotal = 0;
+      printf("%6d", i);
+      for (int j = 0; j < clusterSize; j++) {
+        printf(" %12ld", matrix[i * clusterSize + j]);
+        rowTotal += matrix[i * clusterSize + j];
+      }
+      printf(" %12ld\n", rowTotal);
+    }
+  }
+
   void MasterDataManager::registerVariable(std::string varName, Variable *variable) {
     // Register to your own mapping
     if (varList.count(varName) != 0) {
       delete(varList[varName]);
     }
-    varList[varName] = new MasterVariable(variable->getPtr(), variable->getSize());
+    varList[varName] = new MasterVariable(varName, variable->getPtr(), variable->getSize(), variable->getCols(),
+                                          clusterSize);
   }
 
 }
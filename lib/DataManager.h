@@ -10,16 +10,24 @@
 #include <utility>
 #include <mpi.h>
 #include <map>
+#include <vector>
+#include <mutex>
 #include "domp.h"
 #include "CommandManager.h"
 #include "util/SplitList.h"
+#include "util/TileList.h"
+#include "util/ThreadPool.h"
 
 using namespace std;
 
 namespace domp {
 
 #define DOMP_MIN_DATA_TAG (10)
-#define DOMP_INVALID_NODE (-1)
+// Transfers bigger than the chunk size are sent as chunks, with up to DOMP_CHUNK_WINDOW of them in flight
+#define DOMP_DEFAULT_CHUNK_SIZE (4 * 1024 * 1024)
+#define DOMP_CHUNK_WINDOW (4)
+// Default upper bound of the threads the master maps variables with, also set by DOMP_MAPPING_THREADS
+#define DOMP_MAX_MAPPING_THREADS (8)
 
   class DataManager;
   class MasterDataManager;
@@ -28,7 +36,10 @@ namespace domp {
 
 
   enum MPIServerTag {MPI_MAP_REQ= 0, MPI_MAP_RESP, MPI_DATA_CMD, MPI_EXIT_CMD, MPI_EXIT_ACK};
-  enum MPICommandType {MPI_DATA_FETCH = 0, MPI_DATA_SEND};
+  // Collective commands are followed by one MPI_DATA_PIECE command per node
+  enum MPICommandType {MPI_DATA_FETCH = 0, MPI_DATA_SEND, MPI_DATA_SCATTER, MPI_DATA_GATHER, MPI_DATA_ALLGATHER,
+                       MPI_DATA_PIECE};
+#define IS_COLLECTIVE(e) ((e == MPI_DATA_SCATTER) || (e == MPI_DATA_GATHER) || (e == MPI_DATA_ALLGATHER))
   enum MPIDataPhaseType {DATA_PHASE_READ, DATA_PHASE_UPDATE};
 
   typedef struct DOMPDataCommand {
@@ -38,60 +49,191 @@ namespace domp {
     int nodeId;
     int tagValue;
     MPICommandType commandType;
+    int count;
+    int stride;
+    // Commands of a phase start only after all the commands of previous phases completed on this node
+    int phase;
   } DOMPDataCommand_t;
+
+  // Progress of one point to point data command on this node. All its chunks use the same tag, MPI keeps them in order
+  typedef struct DOMPTransferState {
+    DOMPDataCommand_t *command;
+    char *address;
+    int bytes;
+    MPI_Datatype type;
+    int typeCount;
+    int numChunks;
+    int nextChunk;
+    int doneChunks;
+    // For the tracer, when the first chunk was posted
+    double startTime;
+  } DOMPTransferState_t;
 }
 
 class domp::DataManager {
  protected:
   int clusterSize;
   int rank;
-  std::list<DOMPMapCommand_t*> mapRequest;
+  // Requests of the current sync, stored by value. Buffers below keep their capacity between syncs, so a steady state
+  // sync doesn't allocate any of them again
+  std::vector<DOMPMapCommand_t> mapRequest;
+  // Every thread that requests data appends to its own queue, so requests need no lock. The lock only guards adding
+  // the queue of a new thread. The list keeps queue addresses stable
+  std::list<std::vector<DOMPMapCommand_t> > threadQueues;
+  std::mutex queueLock;
+  int instanceId;
+  std::vector<char> responseBuffer;
+  std::vector<DOMPTransferState_t> transfers;
+  std::vector<MPI_Datatype> tileTypes;
+  std::vector<MPI_Request> chunkRequests;
+  // Transfer and chunk of every request slot
+  std::vector<std::pair<int, int> > chunkSlots;
+  std::vector<int> chunkIndices;
+  std::vector<MPI_Status> chunkStatus;
+  std::vector<int> collectiveCounts;
+  std::vector<int> collectiveDispls;
   DOMP *dompObject;
   MPI_Comm mpi_comm;
+  int chunkSize;
+  DOMP_CHUNK_HOOK chunkHook;
+  void *chunkHookArg;
+  // Time the last triggerMap was blocked on the other nodes, in the probes for the map messages and in the barrier.
+  // Measured in profiling builds only
+  double blockedTime;
+  // Traffic counters, only touched by the thread running the sync
+  std::map<std::string, DOMPCommStats_t> varStats;
+  std::vector<DOMPCommStats_t> peerStats;
+
+  void handleCollective(DOMPDataCommand_t *header, DOMPDataCommand_t *pieces);
+  // Blocking probe for a map message, aborts if it fails
+  void probeMap(int source, int tag, MPI_Status *status);
+  void postChunk(DOMPTransferState_t *transfer, int chunk, MPI_Request *request);
+  void runTransfers();
+  std::vector<DOMPMapCommand_t> *getThreadQueue();
 
  public:
   DataManager(DOMP *dompObject, int clusterSize, int rank);
   virtual ~DataManager();
-  void requestData(std::string varName, int start, int size, MPIAccessType accessType);
+  void requestData(std::string varName, int start, int size, MPIAccessType accessType, int count = 1, int stride = 0);
+  // Move the requests of all the threads to mapRequest for the next triggerMap. Must not run concurrently with
+  // requestData or triggerMap
+  void collectRequests();
   void handleMapResponse(char* buffer, int count);
   virtual void registerVariable(std::string varName, Variable *variable);
+  virtual void unregisterVariable(std::string varName);
+  void setProtocol(std::string varName, DOMP_PROTOCOL protocol);
+  virtual DOMPCoherenceStats_t getCoherenceStats(const std::string &varName);
+  virtual void printStatistics();
+  void setChunkSize(int chunkSize);
+  void setChunkHook(DOMP_CHUNK_HOOK hook, void *arg);
+  // One fragment of varName sent to or received from peer in the given number of messages
+  void countTransfer(const char *varName, int peer, bool sent, long bytes, int messages);
+  DOMPCommStats_t getVariableStats(const std::string &varName);
+  DOMPCommStats_t getPeerStats(int node);
+  // Collective. Totals of every variable and the matrix of the bytes sent between the nodes
+  void printTraffic();
+  double getBlockedTime() {
+    return blockedTime;
+  }
 
   virtual void triggerMap();
 };
 
 class domp::MasterDataManager : public domp::DataManager {
-  std::list<DOMPMapCommand_t*> commands_received;
+  std::vector<DOMPMapCommand_t> commands_received;
+  std::vector<MPI_Request> sendRequests;
   std::map<std::string, MasterVariable*> varList;
   CommandManager *commandManager;
+  // Variables are independent, each one is mapped by one thread of the pool. NULL maps them on the calling thread
+  ThreadPool *mappingPool;
+  std::vector<MasterVariable*> activeVariables;
 
  public:
-  MasterDataManager(DOMP *dompObject, int clusterSize, int rank) :DataManager(dompObject, clusterSize, rank){
-    commandManager =  new CommandManager(clusterSize);
-  };
+  MasterDataManager(DOMP *dompObject, int clusterSize, int rank);
 
   ~MasterDataManager();
 
   void handleMapRequest(MPI_Status *status);
   void triggerMap();
   void registerVariable(std::string varName, Variable *variable);
+  void unregisterVariable(std::string varName);
+  DOMPCoherenceStats_t getCoherenceStats(const std::string &varName);
+  void printStatistics();
 };
 
 
 
 class domp::MasterVariable {
   void *ptr;
+  char varName[DOMP_MAX_VAR_NAME];
   SplitList *dataList;
+  // Only for 2D variables
+  TileList *tileList;
+  // Requests for this variable in the current sync, and the transfers they need. Transfers are merged into the
+  // commands of the sync once all the variables are mapped
+  std::vector<DOMPMapCommand_t*> commands;
+  CommandManager *transfers;
  public:
-  MasterVariable(void * ptr, int size) {
+  MasterVariable(const std::string &varName, void * ptr, int size, int cols, int clusterSize) {
     this->ptr = ptr;
-    dataList = new SplitList(0, size, DOMP_INVALID_NODE);
+    strncpy(this->varName, varName.c_str(), DOMP_MAX_VAR_NAME);
+    this->varName[DOMP_MAX_VAR_NAME - 1] = 0;
+    transfers = new CommandManager(clusterSize);
+    dataList = NULL;
+    tileList = NULL;
+    if (cols > 0) {
+      tileList = new TileList(size / cols, cols, DOMP_INVALID_NODE, clusterSize);
+    } else {
+      dataList = new SplitList(0, size, DOMP_INVALID_NODE, clusterSize);
+    }
   }
 
   ~MasterVariable() {
     delete(dataList);
+    delete(tileList);
+    delete(transfers);
+  }
+
+  void addCommand(DOMPMapCommand_t *command) {
+    commands.push_back(command);
+  }
+
+  bool isActive() const {
+    return !commands.empty() || getProtocol() == PROTOCOL_UPDATE;
+  }
+
+  CommandManager *getTransfers() {
+    return transfers;
+  }
+
+  // Push, read and write phases of this variable for the commands of the sync
+  void mapCommands();
+
+  void setProtocol(DOMP_PROTOCOL protocol) {
+    if (tileList != NULL) tileList->SetProtocol(protocol);
+    else dataList->SetProtocol(protocol);
+  }
+
+  DOMP_PROTOCOL getProtocol() const {
+    return (tileList != NULL) ? tileList->GetProtocol() : dataList->GetProtocol();
+  }
+
+  const CoherenceStats_t &getStats() const {
+    return (tileList != NULL) ? tileList->GetStats() : dataList->GetStats();
+  }
+
+  void pushUpdates(CommandManager *commandManager, char *varName) {
+    if (tileList != NULL) tileList->PushPhase(commandManager, varName);
+    else dataList->PushPhase(commandManager, varName);
   }
 
   void applyCommand(CommandManager *commandManager, DOMPMapCommand_t *command, MPIDataPhaseType phase) {
+    if (tileList != NULL) {
+      if (phase == DATA_PHASE_READ)
+        tileList->ReadPhase(command, commandManager);
+      else tileList->WritePhase(command);
+      return;
+    }
     if (phase == DATA_PHASE_READ)
       dataList->ReadPhase(command, commandManager);
     else dataList->WritePhase(command);
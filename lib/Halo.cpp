@@ -0,0 +1,162 @@
+//
+// Ghost cell exchange between neighbouring nodes, used by DOMP_HALO.
+//
+
+#include <algorithm>
+#include "Halo.h"
+#include "domp.h"
+#include "DataManager.h"
+
+namespace domp {
+  Halo::Halo(int width, bool periodic, int layoutVersion, int rank, int clusterSize) {
+    this->width = width;
+    this->periodic = periodic;
+    this->layoutVersion = layoutVersion;
+    this->rank = rank;
+    this->clusterSize = clusterSize;
+    // Collective call. Halo messages never match the data commands of the sync
+    MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+  }
+
+  Halo::~Halo() {
+    for (unsigned int i = 0; i < requests.size(); i++) {
+      MPI_Request_free(&requests[i]);
+    }
+    for (std::list<MPI_Datatype>::iterator it = types.begin(); it != types.end(); ++it) {
+      MPI_Type_free(&(*it));
+    }
+    MPI_Comm_free(&comm);
+  }
+
+  MPI_Datatype Halo::createBlockType(int rows, int rowBytes, int strideBytes) {
+    MPI_Datatype type;
+    MPI_Type_vector(rows, rowBytes, strideBytes, MPI_BYTE, &type);
+    MPI_Type_commit(&type);
+    types.push_back(type);
+    return type;
+  }
+
+  // Own edge goes towards the neighbour, its edge on the opposite side comes back as our ghost cells
+  void Halo::addExchange(char *sendAddress, char *recvAddress, int sendCount, int recvCount, MPI_Datatype sendType,
+                         MPI_Datatype recvType, int peer, HALO_DIRECTION direction, HALO_DIRECTION opposite) {
+    MPI_Request request;
+    MPI_Recv_init(recvAddress, recvCount, recvType, peer, opposite, comm, &request);
+    requests.push_back(request);
+    MPI_Send_init(sendAddress, sendCount, sendType, peer, direction, comm, &request);
+    requests.push_back(request);
+    int sendTypeSize, recvTypeSize;
+    MPI_Type_size(sendType, &sendTypeSize);
+    MPI_Type_size(recvType, &recvTypeSize);
+    HaloTraffic_t exchange = {peer, (long) sendCount * sendTypeSize, (long) recvCount * recvTypeSize};
+    traffic.push_back(exchange);
+    log("Node %d::Halo exchange with node %d, Direction[%d]", rank, peer, direction);
+  }
+
+  void Halo::Setup1D(char *ptr, int elementSize, int totalSize, int offset, int size) {
+    int layout[2] = {offset, size};
+    std::vector<int> layouts(2 * clusterSize);
+    MPI_Allgather(layout, 2, MPI_INT, &layouts[0], 2, MPI_INT, comm);
+    if (size <= 0) return;
+
+    int west = DOMP_INVALID_NODE, east = DOMP_INVALID_NODE;
+    for (int node = 0; node < clusterSize; node++) {
+      int nodeOffset = layouts[2 * node], nodeSize = layouts[2 * node + 1];
+      if (node == rank || nodeSize <= 0) continue;
+      if (nodeOffset + nodeSize == offset || (periodic && offset == 0 && nodeOffset + nodeSize == totalSize)) {
+        west = node;
+      }
+      if (nodeOffset == offset + size || (periodic && offset + size == totalSize && nodeOffset == 0)) {
+        east = node;
+      }
+    }
+
+    if (west != DOMP_INVALID_NODE) {
+      int westEnd = layouts[2 * west] + layouts[2 * west + 1];
+      int sendWidth = std::min(width, size);
+      int recvWidth = std::min(width, layouts[2 * west + 1]);
+      addExchange(ptr + (long) offset * elementSize, ptr + (long) (westEnd - recvWidth) * elementSize,
+                  sendWidth * elementSize, recvWidth * elementSize, MPI_BYTE, MPI_BYTE, west, HALO_WEST, HALO_EAST);
+    }
+    if (east != DOMP_INVALID_NODE) {
+      int sendWidth = std::min(width, size);
+      int recvWidth = std::min(width, layouts[2 * east + 1]);
+      addExchange(ptr + (long) (offset + size - sendWidth) * elementSize,
+                  ptr + (long) layouts[2 * east] * elementSize, sendWidth * elementSize, recvWidth * elementSize,
+                  MPI_BYTE, MPI_BYTE, east, HALO_EAST, HALO_WEST);
+    }
+  }
+
+  void Halo::Setup2D(char *ptr, int elementSize, int cols, int gridRows, int gridCols, int rowOffset, int rowSize,
+                     int colOffset, int colSize) {
+    int layout[4] = {rowOffset, rowSize, colOffset, colSize};
+    std::vector<int> layouts(4 * clusterSize);
+    MPI_Allgather(layout, 4, MPI_INT, &layouts[0], 4, MPI_INT, comm);
+    if (rowSize <= 0 || colSize <= 0) return;
+
+    int gridRow = rank / gridCols, gridCol = rank % gridCols;
+    int strideBytes = cols * elementSize;
+    // Neighbours on the process grid, corners are not exchanged
+    int neighbours[4];
+    neighbours[HALO_NORTH] = (gridRow > 0 || periodic) ? ((gridRow + gridRows - 1) % gridRows) * gridCols + gridCol
+                                                      : DOMP_INVALID_NODE;
+    neighbours[HALO_SOUTH] = (gridRow < gridRows - 1 || periodic) ? ((gridRow + 1) % gridRows) * gridCols + gridCol
+                                                                : DOMP_INVALID_NODE;
+    neighbours[HALO_WEST] = (gridCol > 0 || periodic) ? gridRow * gridCols + (gridCol + gridCols - 1) % gridCols
+                                                     : DOMP_INVALID_NODE;
+    neighbours[HALO_EAST] = (gridCol < gridCols - 1 || periodic) ? gridRow * gridCols + (gridCol + 1) % gridCols
+                                                               : DOMP_INVALID_NODE;
+
+    for (int direction = HALO_NORTH; direction <= HALO_EAST; direction++) {
+      int peer = neighbours[direction];
+      if (peer == DOMP_INVALID_NODE || peer == rank) continue;
+      int peerRowOffset = layouts[4 * peer], peerRowSize = layouts[4 * peer + 1];
+      int peerColOffset = layouts[4 * peer + 2], peerColSize = layouts[4 * peer + 3];
+      if (peerRowSize <= 0 || peerColSize <= 0) continue;
+
+      long sendStart, recvStart;
+      MPI_Datatype sendType, recvType;
+      HALO_DIRECTION opposite;
+      if (direction == HALO_NORTH || direction == HALO_SOUTH) {
+        int sendWidth = std::min(width, rowSize);
+        int recvWidth = std::min(width, peerRowSize);
+        if (direction == HALO_NORTH) {
+          sendStart = rowOffset;
+          recvStart = peerRowOffset + peerRowSize - recvWidth;
+          opposite = HALO_SOUTH;
+        } else {
+          sendStart = rowOffset + rowSize - sendWidth;
+          recvStart = peerRowOffset;
+          opposite = HALO_NORTH;
+        }
+        sendStart = sendStart * cols + colOffset;
+        recvStart = recvStart * cols + colOffset;
+        sendType = createBlockType(sendWidth, colSize * elementSize, strideBytes);
+        recvType = createBlockType(recvWidth, colSize * elementSize, strideBytes);
+      } else {
+        int sendWidth = std::min(width, colSize);
+        int recvWidth = std::min(width, peerColSize);
+        if (direction == HALO_WEST) {
+          sendStart = colOffset;
+          recvStart = peerColOffset + peerColSize - recvWidth;
+          opposite = HALO_EAST;
+        } else {
+          sendStart = colOffset + colSize - sendWidth;
+          recvStart = peerColOffset;
+          opposite = HALO_WEST;
+        }
+        sendStart += (long) rowOffset * cols;
+        recvStart += (long) rowOffset * cols;
+        sendType = createBlockType(rowSize, sendWidth * elementSize, strideBytes);
+        recvType = createBlockType(rowSize, recvWidth * elementSize, strideBytes);
+      }
+      addExchange(ptr + sendStart * elementSize, ptr + recvStart * elementSize, 1, 1, sendType, recvType, peer,
+                  (HALO_DIRECTION) direction, opposite);
+    }
+  }
+
+  void Halo::Exchange() {
+    if (requests.empty()) return;
+    MPI_Startall(requests.size(), &requests[0]);
+    MPI_Waitall(requests.size(), &requests[0], MPI_STATUSES_IGNORE);
+  }
+}
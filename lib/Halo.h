@@ -0,0 +1,59 @@
+//
+// Ghost cell exchange between neighbouring nodes, used by DOMP_HALO.
+//
+
+#ifndef DOMP_HALO_H
+#define DOMP_HALO_H
+
+#include <list>
+#include <vector>
+#include <mpi.h>
+
+namespace domp {
+  class Halo;
+
+  enum HALO_DIRECTION {HALO_NORTH, HALO_SOUTH, HALO_WEST, HALO_EAST};
+
+  // Bytes one exchange sends to and receives from its peer
+  typedef struct HaloTraffic {
+    int peer;
+    long sendBytes;
+    long recvBytes;
+  } HaloTraffic_t;
+}
+
+// Every node keeps the full variable, so ghost cells of a node are just the edges of its neighbours at the same global
+// indices. The exchanges are built once as persistent point to point requests on a private communicator and are then
+// started on every call, the master and its directory are never involved. Ghost cells are not tracked in the
+// directory either, so they must not be used as if they were requested with DOMP_SHARED.
+class domp::Halo {
+  int rank;
+  int clusterSize;
+  int width;
+  bool periodic;
+  int layoutVersion;
+  MPI_Comm comm;
+  std::vector<MPI_Request> requests;
+  std::list<MPI_Datatype> types;
+  std::vector<HaloTraffic_t> traffic;
+
+  void addExchange(char *sendAddress, char *recvAddress, int sendCount, int recvCount, MPI_Datatype sendType,
+                   MPI_Datatype recvType, int peer, HALO_DIRECTION direction, HALO_DIRECTION opposite);
+  MPI_Datatype createBlockType(int rows, int rowBytes, int strideBytes);
+ public:
+  Halo(int width, bool periodic, int layoutVersion, int rank, int clusterSize);
+  ~Halo();
+  // Collective calls, layout of this node is [offset, offset + size) or the given block of a 2D variable
+  void Setup1D(char *ptr, int elementSize, int totalSize, int offset, int size);
+  void Setup2D(char *ptr, int elementSize, int cols, int gridRows, int gridCols, int rowOffset, int rowSize,
+               int colOffset, int colSize);
+  void Exchange();
+  const std::vector<HaloTraffic_t> &GetTraffic() const {
+    return traffic;
+  }
+  bool Matches(int width, bool periodic, int layoutVersion) const {
+    return this->width == width && this->periodic == periodic && this->layoutVersion == layoutVersion;
+  }
+};
+
+#endif //DOMP_HALO_H
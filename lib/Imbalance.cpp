@@ -0,0 +1,149 @@
+//
+// Arrival of every node at the syncs and reductions, reported per call site at finalize to find the stragglers.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <mpi.h>
+#include "Imbalance.h"
+#include "util/CycleTimer.h"
+
+namespace domp {
+  ImbalanceProfiler::ImbalanceProfiler() {
+    origin = currentSeconds();
+    lastExit = origin;
+  }
+
+  int ImbalanceProfiler::getSite(const char *file, int line) {
+    std::pair<const char*, int> key(file, line);
+    std::map<std::pair<const char*, int>, int>::iterator it = siteIds.find(key);
+    if (it != siteIds.end()) return it->second;
+    std::string name = "unknown";
+    if (file != NULL) {
+      const char *base = strrchr(file, '/');
+      name = std::string(base != NULL ? base + 1 : file) + ":" + std::to_string(line);
+    }
+    siteNames.push_back(name);
+    siteIds[key] = siteNames.size() - 1;
+    return siteNames.size() - 1;
+  }
+
+  int ImbalanceProfiler::Arrive(const char *file, int line, double arrival) {
+    DOMPSiteEvent_t event;
+    event.site = getSite(file, line);
+    event.arrival = arrival - origin;
+    event.compute = arrival - lastExit;
+    event.duration = 0;
+    event.wait = 0;
+    events.push_back(event);
+    return events.size() - 1;
+  }
+
+  void ImbalanceProfiler::Leave(int event, double exit) {
+    events[event].duration += exit - origin - events[event].arrival;
+    lastExit = exit;
+  }
+
+  void ImbalanceProfiler::AddTime(int event, double seconds) {
+    events[event].duration += seconds;
+  }
+
+  void ImbalanceProfiler::AddWait(int event, double seconds) {
+    events[event].wait += seconds;
+  }
+
+  void ImbalanceProfiler::Report(int rank, int clusterSize) {
+    int count = events.size();
+    std::vector<int> counts(clusterSize);
+    MPI_Gather(&count, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+    // Events past the shortest history can't be matched between the nodes
+    int numEvents = count;
+    if (rank == 0) {
+      numEvents = *std::min_element(counts.begin(), counts.end());
+    }
+    MPI_Bcast(&numEvents, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (numEvents == 0) return;
+    int bytes = numEvents * sizeof(DOMPSiteEvent_t);
+    std::vector<DOMPSiteEvent_t> all((rank == 0) ? numEvents * clusterSize : 0);
+    MPI_Gather(events.data(), bytes, MPI_BYTE, all.data(), bytes, MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    if (numEvents != *std::max_element(counts.begin(), counts.end())) {
+      printf("DOMP Nodes made different numbers of syncs and reductions, only the first %d are compared\n",
+             numEvents);
+    }
+    // Sites of the master, merged by name
+    std::vector<std::string> names;
+    std::map<std::string, int> nameIds;
+    std::vector<int> siteIndex(siteNames.size());
+    for (unsigned int i = 0; i < siteNames.size(); i++) {
+      if (nameIds.count(siteNames[i]) == 0) {
+        nameIds[siteNames[i]] = names.size();
+        names.push_back(siteNames[i]);
+      }
+      siteIndex[i] = nameIds[siteNames[i]];
+    }
+
+    // Totals per site and node
+    int numSites = names.size();
+    std::vector<double> compute(numSites * clusterSize), skew(numSites * clusterSize), wait(numSites * clusterSize);
+    std::vector<double> duration(numSites * clusterSize);
+    std::vector<int> calls(numSites), lastArrivals(numSites * clusterSize);
+    for (int e = 0; e < numEvents; e++) {
+      int site = siteIndex[events[e].site];
+      int lastNode = 0;
+      for (int node = 1; node < clusterSize; node++) {
+        if (all[node * numEvents + e].arrival > all[lastNode * numEvents + e].arrival) lastNode = node;
+      }
+      double lastArrival = all[lastNode * numEvents + e].arrival;
+      calls[site]++;
+      lastArrivals[site * clusterSize + lastNode]++;
+      for (int node = 0; node < clusterSize; node++) {
+        DOMPSiteEvent_t &event = all[node * numEvents + e];
+        compute[site * clusterSize + node] += event.compute;
+        skew[site * clusterSize + node] += lastArrival - event.arrival;
+        wait[site * clusterSize + node] += event.wait;
+        duration[site * clusterSize + node] += event.duration;
+      }
+    }
+
+    // Imbalance is the compute time of the slowest node over the average, 1 is perfectly balanced
+    for (int site = 0; site < numSites; site++) {
+      double totalCompute = 0, totalSkew = 0, totalWait = 0, maxCompute = 0, maxWait = -1;
+      int maxWaitNode = 0, straggler = 0;
+      for (int node = 0; node < clusterSize; node++) {
+        int index = site * clusterSize + node;
+        totalCompute += compute[index];
+        totalSkew += skew[index];
+        totalWait += wait[index];
+        maxCompute = std::max(maxCompute, compute[index]);
+        if (wait[index] > maxWait) {
+          maxWait = wait[index];
+          maxWaitNode = node;
+        }
+        if (lastArrivals[index] > lastArrivals[site * clusterSize + straggler]) straggler = node;
+      }
+      double imbalance = (totalCompute > 0) ? maxCompute * clusterSize / totalCompute : 1;
+      printf("DOMP Site[%s] calls = %d, imbalance = %.2f, avg compute = %.4f sec, avg arrival skew = %.4f sec, avg "
+             "wait = %.4f sec, max wait = %.4f sec on node %d, straggler = node %d (last in %d calls)\n",
+             names[site].c_str(), calls[site], imbalance, totalCompute / clusterSize, totalSkew / clusterSize,
+             totalWait / clusterSize, maxWait, maxWaitNode, straggler, lastArrivals[site * clusterSize + straggler]);
+    }
+    for (int node = 0; node < clusterSize; node++) {
+      double nodeCompute = 0, nodeSkew = 0, nodeWait = 0, nodeDuration = 0;
+      int nodeLast = 0;
+      for (int site = 0; site < numSites; site++) {
+        int index = site * clusterSize + node;
+        nodeCompute += compute[index];
+        nodeSkew += skew[index];
+        nodeWait += wait[index];
+        nodeDuration += duration[index];
+        nodeLast += lastArrivals[index];
+      }
+      printf("DOMP Node[%d] compute = %.4f sec, arrival skew = %.4f sec, wait = %.4f sec, sync and reduce = %.4f sec, "
+             "last to arrive in %d of %d calls\n", node, nodeCompute, nodeSkew, nodeWait, nodeDuration, nodeLast,
+             numEvents);
+    }
+  }
+}
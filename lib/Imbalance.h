@@ -0,0 +1,57 @@
+//
+// Arrival of every node at the syncs and reductions, reported per call site at finalize with DOMP_REPORT=1 to find the
+// stragglers.
+//
+
+#ifndef DOMP_IMBALANCE_H
+#define DOMP_IMBALANCE_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace domp {
+  class ImbalanceProfiler;
+
+  typedef struct DOMPSiteEvent {
+    int site;
+    // Seconds since the profiler started
+    double arrival;
+    // Time since this node left the previous sync or reduction, halo exchanges included
+    double compute;
+    // Time spent in the call, waiting included
+    double duration;
+    // Part of the duration measured blocked on the other nodes, in a barrier, a probe or a reduction
+    double wait;
+  } DOMPSiteEvent_t;
+}
+
+// Syncs and reductions are collective, so the n-th event is the same call on every node. The skew of a node in a call
+// is the time between its arrival and the arrival of the last node. Not every node waits for all of it, the nodes
+// other than the root leave an MPI_Reduce early, so the wait reported is the blocked time measured by each node.
+// Clocks of the nodes are aligned by the barrier before the profiler starts. Every call keeps one event until finalize
+class domp::ImbalanceProfiler {
+  double origin;
+  double lastExit;
+  // By the address of __FILE__, sites with the same name are merged in the report
+  std::map<std::pair<const char*, int>, int> siteIds;
+  std::vector<std::string> siteNames;
+  std::vector<DOMPSiteEvent_t> events;
+
+  int getSite(const char *file, int line);
+ public:
+  ImbalanceProfiler();
+  // Returns the event for Leave and AddTime
+  int Arrive(const char *file, int line, double arrival);
+  // Computation after exit counts for the next event
+  void Leave(int event, double exit);
+  // Time of the event spent after Leave, like the wait in DOMP_SYNC_END
+  void AddTime(int event, double seconds);
+  // Time of the event blocked on the other nodes
+  void AddWait(int event, double seconds);
+  // Collective. The master prints every site and every node
+  void Report(int rank, int clusterSize);
+};
+
+#endif //DOMP_IMBALANCE_H
@@ -0,0 +1,212 @@
+//
+// Hardware counters of named code regions, read from Linux perf_event and reported for the cluster at finalize.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <vector>
+#include "PerfRegions.h"
+
+namespace domp {
+  PerfRegions *dompPerf = NULL;
+
+  void PerfRegionBegin(const char *name) {
+    dompPerf->Begin(name);
+  }
+
+  void PerfRegionEnd(const char *name) {
+    dompPerf->End(name);
+  }
+
+  void PerfRegionOpenThread() {
+    dompPerf->OpenThread();
+  }
+
+  PerfRegions::PerfRegions(int rank) {
+    this->rank = rank;
+  }
+
+  PerfRegions::~PerfRegions() {
+    for (unsigned int i = 0; i < fds.size(); i++) {
+      close(fds[i]);
+    }
+  }
+
+  // User space events of the calling thread only, counted from now on
+  bool PerfRegions::open() {
+    static const unsigned long configs[PERF_NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                             PERF_COUNT_HW_CACHE_REFERENCES,
+                                                             PERF_COUNT_HW_CACHE_MISSES};
+    pid_t thread = (pid_t) syscall(SYS_gettid);
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned int i = 0; i < threads.size(); i++) {
+      if (threads[i] == thread) return true;
+    }
+    int threadFds[PERF_NUM_COUNTERS];
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // Counters may be multiplexed, counts are scaled by the time they were running
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      threadFds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      if (threadFds[i] < 0) {
+        log("Node %d::perf_event_open failed for counter %d of thread %d with %s", rank, i, (int) thread,
+            strerror(errno));
+        for (int j = 0; j < i; j++) close(threadFds[j]);
+        return false;
+      }
+    }
+    fds.insert(fds.end(), threadFds, threadFds + PERF_NUM_COUNTERS);
+    threads.push_back(thread);
+    return true;
+  }
+
+  void PerfRegions::OpenThread() {
+    if (!open()) {
+      std::cout<<"ERROR: DOMP_PERF could not open the hardware counters of a thread on node "<<rank
+               <<", its events are not counted"<<std::endl;
+    }
+  }
+
+  // Sum of the counted threads
+  void PerfRegions::read(long *counts) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+      counts[i] = 0;
+      for (unsigned int t = i; t < fds.size(); t += PERF_NUM_COUNTERS) {
+        unsigned long values[3] = {0, 0, 0};
+        if (::read(fds[t], values, sizeof(values)) != sizeof(values) || values[2] == 0) continue;
+        counts[i] += (long) ((double) values[0] * values[1] / values[2]);
+      }
+    }
+  }
+
+  void PerfRegions::Init(int rank) {
+    int enabled = 0;
+    if (rank == 0) {
+      const char *perfEnv = getenv("DOMP_PERF");
+      enabled = perfEnv != NULL && strcmp(perfEnv, "1") == 0;
+    }
+    MPI_Bcast(&enabled, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!enabled) return;
+    PerfRegions *perf = new PerfRegions(rank);
+    int opened = perf->open() ? 1 : 0, allOpened;
+    MPI_Allreduce(&opened, &allOpened, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!allOpened) {
+      if (rank == 0) {
+        std::cout<<"ERROR: DOMP_PERF could not open the hardware counters on every node, regions are disabled"
+                 <<std::endl;
+      }
+      delete(perf);
+      return;
+    }
+    dompPerf = perf;
+  }
+
+  void PerfRegions::Begin(const char *name) {
+    DOMPRegionStats_t &region = regions[name];
+    if (region.depth++ > 0) return;
+    region.startTime = currentSeconds();
+    read(region.startCounts);
+  }
+
+  void PerfRegions::End(const char *name) {
+    std::map<std::string, DOMPRegionStats_t>::iterator it = regions.find(name);
+    if (it == regions.end() || it->second.depth == 0) {
+      log("Node %d::Region %s ended without a begin", rank, name);
+      return;
+    }
+    DOMPRegionStats_t &region = it->second;
+    if (--region.depth > 0) return;
+    long counts[PERF_NUM_COUNTERS];
+    read(counts);
+    region.time += currentSeconds() - region.startTime;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+      region.counts[i] += counts[i] - region.startCounts[i];
+    }
+    region.calls++;
+  }
+
+  typedef struct RegionTotals {
+    char name[DOMP_MAX_VAR_NAME];
+    int node;
+    long calls;
+    double time;
+    long counts[PERF_NUM_COUNTERS];
+  } RegionTotals_t;
+
+  void PerfRegions::Report(int clusterSize) {
+    // Nodes may have entered different regions, so they are gathered by name
+    std::vector<RegionTotals_t> local;
+    for (std::map<std::string, DOMPRegionStats_t>::iterator it = regions.begin(); it != regions.end(); ++it) {
+      RegionTotals_t totals;
+      memset(&totals, 0, sizeof(totals));
+      strncpy(totals.name, it->first.c_str(), DOMP_MAX_VAR_NAME - 1);
+      totals.node = rank;
+      totals.calls = it->second.calls;
+      totals.time = it->second.time;
+      memcpy(totals.counts, it->second.counts, sizeof(totals.counts));
+      local.push_back(totals);
+    }
+    int bytes = local.size() * sizeof(RegionTotals_t);
+    std::vector<int> counts(clusterSize), displs(clusterSize);
+    MPI_Gather(&bytes, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::vector<char> all;
+    if (rank == 0) {
+      int offset = 0;
+      for (int i = 0; i < clusterSize; i++) {
+        displs[i] = offset;
+        offset += counts[i];
+      }
+      all.resize(offset);
+    }
+    MPI_Gatherv(local.data(), bytes, MPI_BYTE, all.data(), &counts[0], &displs[0], MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    std::map<std::string, RegionTotals_t> cluster;
+    std::map<std::string, int> nodes;
+    // Slowest node of every region
+    std::map<std::string, std::pair<double, int> > slowest;
+    for (unsigned int i = 0; i < all.size() / sizeof(RegionTotals_t); i++) {
+      RegionTotals_t *totals = reinterpret_cast<RegionTotals_t *>(&all[i * sizeof(RegionTotals_t)]);
+      std::string name(totals->name);
+      if (cluster.count(name) == 0) {
+        RegionTotals_t empty;
+        memset(&empty, 0, sizeof(empty));
+        cluster[name] = empty;
+        slowest[name] = std::make_pair(-1.0, 0);
+      }
+      RegionTotals_t &sum = cluster[name];
+      sum.calls += totals->calls;
+      sum.time += totals->time;
+      for (int c = 0; c < PERF_NUM_COUNTERS; c++) sum.counts[c] += totals->counts[c];
+      nodes[name]++;
+      if (totals->time > slowest[name].first) slowest[name] = std::make_pair(totals->time, totals->node);
+    }
+    for (std::map<std::string, RegionTotals_t>::iterator it = cluster.begin(); it != cluster.end(); ++it) {
+      RegionTotals_t &sum = it->second;
+      int numNodes = nodes[it->first];
+      double ipc = (sum.counts[PERF_CYCLES] > 0) ? (double) sum.counts[PERF_INSTRUCTIONS] / sum.counts[PERF_CYCLES]
+                                                 : 0;
+      double missRate = (sum.counts[PERF_CACHE_REFERENCES] > 0) ?
+                        100.0 * sum.counts[PERF_CACHE_MISSES] / sum.counts[PERF_CACHE_REFERENCES] : 0;
+      double bandwidth = (sum.time > 0) ? (double) sum.counts[PERF_CACHE_MISSES] * DOMP_CACHE_LINE_SIZE / sum.time
+                                        : 0;
+      printf("DOMP Region[%s] nodes = %d, calls = %ld, avg time = %.4f sec, max time = %.4f sec on node %d, "
+             "IPC = %.2f, cache misses = %ld (%.1f%% of references), memory bandwidth per node = %.2f GB/s\n",
+             it->first.c_str(), numNodes, sum.calls, sum.time / numNodes, slowest[it->first].first,
+             slowest[it->first].second, ipc, sum.counts[PERF_CACHE_MISSES], missRate, bandwidth / 1e9);
+    }
+  }
+}
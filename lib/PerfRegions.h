@@ -0,0 +1,60 @@
+//
+// Hardware counters of named code regions, read from Linux perf_event and reported for the cluster at finalize.
+//
+
+#ifndef DOMP_PERFREGIONS_H
+#define DOMP_PERFREGIONS_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "domp.h"
+
+namespace domp {
+  enum DOMP_PERF_COUNTER {PERF_CYCLES = 0, PERF_INSTRUCTIONS, PERF_CACHE_REFERENCES, PERF_CACHE_MISSES,
+                          PERF_NUM_COUNTERS};
+
+  typedef struct DOMPRegionStats {
+    long calls;
+    double time;
+    long counts[PERF_NUM_COUNTERS];
+    // Of the outermost call when the region is nested in itself
+    int depth;
+    double startTime;
+    long startCounts[PERF_NUM_COUNTERS];
+  } DOMPRegionStats_t;
+}
+
+// Enabled on all the nodes by DOMP_PERF=1 in the environment of the master, and only if every node could open the
+// counters of its main thread. A counter only sees the thread that opened it, so DOMP_INIT opens one set in every
+// thread of the OpenMP pool too, and a region sums the sets of all of them. Threads joining the pool later, for
+// example with a larger num_threads clause, are not counted, neither are the progress thread and the mapping threads
+// of the master. Regions must be entered and left outside of parallel regions. Memory bandwidth is estimated from the
+// last level cache misses, the memory controller counters are not readable per process
+class domp::PerfRegions {
+  int rank;
+  // PERF_NUM_COUNTERS descriptors for every counted thread
+  std::vector<int> fds;
+  std::vector<pid_t> threads;
+  std::mutex lock;
+  std::map<std::string, DOMPRegionStats_t> regions;
+
+  PerfRegions(int rank);
+  // Counters of the calling thread, nothing if it already has them
+  bool open();
+  void read(long *counts);
+ public:
+  ~PerfRegions();
+  // Collective. Creates dompPerf if enabled, counting the calling thread
+  static void Init(int rank);
+  // Called by every thread of the OpenMP pool from DOMP_INIT
+  void OpenThread();
+  void Begin(const char *name);
+  void End(const char *name);
+  // Collective. The master prints every region
+  void Report(int clusterSize);
+};
+
+#endif //DOMP_PERFREGIONS_H
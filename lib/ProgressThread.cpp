@@ -0,0 +1,99 @@
+//
+// Background thread running syncs and reductions started by DOMP_SYNC_BEGIN and the *_BEGIN reductions.
+//
+
+#include <sched.h>
+#include <chrono>
+#include "ProgressThread.h"
+#include "domp.h"
+
+// How long the idle thread sleeps between two polls of MPI
+#define DOMP_PROGRESS_POLL_US (50)
+
+namespace domp {
+  ProgressThread::ProgressThread(int rank, int core) {
+    this->rank = rank;
+    this->core = core;
+    submitted = completed = 0;
+    stopping = false;
+    thread = std::thread(&ProgressThread::run, this);
+  }
+
+  ProgressThread::~ProgressThread() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    taskReady.notify_all();
+    thread.join();
+  }
+
+  long ProgressThread::Submit(std::function<void()> task) {
+    long ticket;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      tasks.push_back(task);
+      ticket = ++submitted;
+    }
+    taskReady.notify_all();
+    return ticket;
+  }
+
+  void ProgressThread::Wait(long ticket) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (completed < ticket) {
+      taskDone.wait(guard);
+    }
+  }
+
+  void ProgressThread::WaitAll() {
+    long ticket;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      ticket = submitted;
+    }
+    Wait(ticket);
+  }
+
+  bool ProgressThread::Idle() {
+    std::lock_guard<std::mutex> guard(lock);
+    return completed == submitted;
+  }
+
+  void ProgressThread::run() {
+    if (core >= 0) {
+      // Pid zero is the calling thread
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(core, &mask);
+      if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+        log("Node %d::Progress thread could not be pinned to core %d", rank, core);
+      }
+    }
+    log("Node %d::Progress thread started on core %d", rank, core);
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      if (!tasks.empty()) {
+        std::function<void()> task = tasks.front();
+        tasks.pop_front();
+        guard.unlock();
+        task();
+        guard.lock();
+        completed++;
+        taskDone.notify_all();
+        continue;
+      }
+      if (stopping) break;
+      taskReady.wait_for(guard, std::chrono::microseconds(DOMP_PROGRESS_POLL_US));
+      if (tasks.empty() && !stopping) {
+        // Any MPI call drives the progress engine of the library, for all the communicators
+        guard.unlock();
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_SELF, &flag, MPI_STATUS_IGNORE);
+        guard.lock();
+      }
+    }
+    log("Node %d::Progress thread stopped", rank);
+  }
+}
@@ -0,0 +1,47 @@
+//
+// Background thread running syncs and reductions started by DOMP_SYNC_BEGIN and the *_BEGIN reductions.
+//
+
+#ifndef DOMP_PROGRESSTHREAD_H
+#define DOMP_PROGRESSTHREAD_H
+
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <mpi.h>
+
+namespace domp {
+  class ProgressThread;
+}
+
+// Tasks run one at a time in the order they were submitted. Every node submits its syncs and reductions in the same
+// order, so the collectives inside them match. While there is no task the thread keeps polling MPI, so transfers of
+// the application and of DOMP progress while the application computes. Needs MPI_THREAD_MULTIPLE.
+class domp::ProgressThread {
+  int rank;
+  // Core the thread is pinned to, or -1
+  int core;
+  std::thread thread;
+  std::mutex lock;
+  std::condition_variable taskReady;
+  std::condition_variable taskDone;
+  std::deque<std::function<void()> > tasks;
+  long submitted;
+  long completed;
+  bool stopping;
+
+  void run();
+ public:
+  ProgressThread(int rank, int core);
+  // Runs the remaining tasks first
+  ~ProgressThread();
+  // Returns a ticket for Wait
+  long Submit(std::function<void()> task);
+  void Wait(long ticket);
+  void WaitAll();
+  bool Idle();
+};
+
+#endif //DOMP_PROGRESSTHREAD_H
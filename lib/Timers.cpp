@@ -0,0 +1,101 @@
+//
+// Named timers of DOMP_SCOPED_TIMER, with a histogram of the durations on every node printed at finalize.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Timers.h"
+
+namespace domp {
+  TimerRegistry *dompTimers = NULL;
+
+  void RecordTimer(const char *name, double seconds) {
+    dompTimers->Record(name, seconds);
+  }
+
+  TimerRegistry::TimerRegistry(int rank) {
+    this->rank = rank;
+  }
+
+  // Bucket 0 is below 1us, bucket b above it starts at 2^(b-1) us
+  static int timerBucket(double seconds) {
+    double micros = seconds * 1e6;
+    if (micros < 1) return 0;
+    int bucket = 1 + (int) log2(micros);
+    return (bucket < DOMP_TIMER_BUCKETS) ? bucket : DOMP_TIMER_BUCKETS - 1;
+  }
+
+  void TimerRegistry::Record(const char *name, double seconds) {
+    std::lock_guard<std::mutex> guard(lock);
+    DOMPTimerStats_t &stats = timers[name];
+    if (stats.count == 0 || seconds < stats.min) stats.min = seconds;
+    if (stats.count == 0 || seconds > stats.max) stats.max = seconds;
+    stats.count++;
+    stats.total += seconds;
+    stats.buckets[timerBucket(seconds)]++;
+  }
+
+  DOMPTimerStats_t TimerRegistry::Get(const std::string &name) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, DOMPTimerStats_t>::iterator it = timers.find(name);
+    return (it != timers.end()) ? it->second : DOMPTimerStats_t();
+  }
+
+  typedef struct NodeTimer {
+    char name[DOMP_MAX_VAR_NAME];
+    int node;
+    DOMPTimerStats_t stats;
+  } NodeTimer_t;
+
+  void TimerRegistry::Report(int clusterSize) {
+    std::vector<NodeTimer_t> local;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (std::map<std::string, DOMPTimerStats_t>::iterator it = timers.begin(); it != timers.end(); ++it) {
+        NodeTimer_t timer;
+        memset(&timer, 0, sizeof(timer));
+        strncpy(timer.name, it->first.c_str(), DOMP_MAX_VAR_NAME - 1);
+        timer.node = rank;
+        timer.stats = it->second;
+        local.push_back(timer);
+      }
+    }
+    int bytes = local.size() * sizeof(NodeTimer_t);
+    std::vector<int> counts(clusterSize), displs(clusterSize);
+    MPI_Gather(&bytes, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::vector<char> all;
+    if (rank == 0) {
+      int offset = 0;
+      for (int i = 0; i < clusterSize; i++) {
+        displs[i] = offset;
+        offset += counts[i];
+      }
+      all.resize(offset);
+    }
+    MPI_Gatherv(local.data(), bytes, MPI_BYTE, all.data(), &counts[0], &displs[0], MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    // By name, then by node
+    std::map<std::string, std::vector<NodeTimer_t*> > byName;
+    for (unsigned int i = 0; i < all.size() / sizeof(NodeTimer_t); i++) {
+      NodeTimer_t *timer = reinterpret_cast<NodeTimer_t *>(&all[i * sizeof(NodeTimer_t)]);
+      byName[timer->name].push_back(timer);
+    }
+    for (std::map<std::string, std::vector<NodeTimer_t*> >::iterator it = byName.begin(); it != byName.end(); ++it) {
+      for (unsigned int i = 0; i < it->second.size(); i++) {
+        DOMPTimerStats_t &stats = it->second[i]->stats;
+        printf("DOMP Timer[%s] node %d: count = %ld, total = %.6f sec, avg = %.6f sec, min = %.6f sec, max = %.6f sec,"
+               " histogram =", it->first.c_str(), it->second[i]->node, stats.count, stats.total,
+               stats.total / stats.count, stats.min, stats.max);
+        for (int b = 0; b < DOMP_TIMER_BUCKETS; b++) {
+          if (stats.buckets[b] == 0) continue;
+          if (b == 0) printf(" <1us:%ld", stats.buckets[b]);
+          else printf(" %ldus:%ld", 1L << (b - 1), stats.buckets[b]);
+        }
+        printf("\n");
+      }
+    }
+  }
+}
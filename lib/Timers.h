@@ -0,0 +1,30 @@
+//
+// Named timers of DOMP_SCOPED_TIMER, with a histogram of the durations on every node printed at finalize.
+//
+
+#ifndef DOMP_TIMERS_H
+#define DOMP_TIMERS_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include "domp.h"
+
+namespace domp {
+  class TimerRegistry;
+}
+
+class domp::TimerRegistry {
+  int rank;
+  std::mutex lock;
+  std::map<std::string, DOMPTimerStats_t> timers;
+ public:
+  TimerRegistry(int rank);
+  // Safe to call from several threads
+  void Record(const char *name, double seconds);
+  DOMPTimerStats_t Get(const std::string &name);
+  // Collective. The master prints every timer of every node
+  void Report(int clusterSize);
+};
+
+#endif //DOMP_TIMERS_H
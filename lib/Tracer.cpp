@@ -0,0 +1,136 @@
+//
+// Timeline of DOMP events on every node, written as a Chrome trace (viewable in Perfetto) at finalize.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "Tracer.h"
+
+namespace domp {
+  Tracer *dompTracer = NULL;
+
+  // Small number per thread, shown as the thread of its events
+  static std::atomic<int> threadCounter(0);
+  static int traceThreadId() {
+    static thread_local int id = threadCounter++;
+    return id;
+  }
+
+  Tracer::Tracer(int rank, const std::string &path) : next(0) {
+    this->rank = rank;
+    this->path = path;
+    int capacity = DOMP_TRACE_DEFAULT_EVENTS;
+    const char *eventsEnv = getenv("DOMP_TRACE_EVENTS");
+    if (eventsEnv != NULL && atoi(eventsEnv) > 0) {
+      capacity = atoi(eventsEnv);
+    }
+    events.resize(capacity);
+    // Called right after a barrier, so the timelines of the nodes start together
+    origin = currentSeconds();
+  }
+
+  void Tracer::Init(int rank) {
+    char path[1024] = {0};
+    if (rank == 0) {
+      const char *traceEnv = getenv("DOMP_TRACE");
+      if (traceEnv != NULL) strncpy(path, traceEnv, sizeof(path) - 1);
+    }
+    MPI_Bcast(path, sizeof(path), MPI_CHAR, 0, MPI_COMM_WORLD);
+    if (path[0] == 0) return;
+    MPI_Barrier(MPI_COMM_WORLD);
+    dompTracer = new Tracer(rank, path);
+    log("Node %d::Tracing to %s", rank, path);
+  }
+
+  const char *Tracer::typeName(DOMP_TRACE_TYPE type) {
+    static const char *names[TRACE_NUM_TYPES] = {"request", "sync", "map send", "map recv", "master recv",
+                                                 "master push", "master read", "master update", "master schedule",
+                                                 "master send", "fetch", "send", "collective", "barrier", "reduce",
+                                                 "halo"};
+    return (type >= 0 && type < TRACE_NUM_TYPES) ? names[type] : "unknown";
+  }
+
+  const char *Tracer::sizeName(DOMP_TRACE_TYPE type) {
+    if (type == TRACE_REQUEST) return "elements";
+    if (type == TRACE_MASTER_READ || type == TRACE_MASTER_UPDATE) return "commands";
+    return "bytes";
+  }
+
+  void Tracer::Record(DOMP_TRACE_TYPE type, const char *varName, double start, double end, int peer, long size) {
+    unsigned long slot = next.fetch_add(1, std::memory_order_relaxed) % events.size();
+    DOMPTraceEvent_t &event = events[slot];
+    event.start = start - origin;
+    event.duration = end - start;
+    event.type = type;
+    event.thread = traceThreadId();
+    event.peer = peer;
+    event.size = size;
+    event.varName[0] = 0;
+    if (varName != NULL) {
+      strncpy(event.varName, varName, DOMP_MAX_VAR_NAME - 1);
+      event.varName[DOMP_MAX_VAR_NAME - 1] = 0;
+    }
+  }
+
+  void Tracer::Export(int clusterSize) {
+    // Oldest first, only the events still in the buffer
+    unsigned long total = next.load();
+    int count = (int) std::min(total, (unsigned long) events.size());
+    std::vector<DOMPTraceEvent_t> local(count);
+    for (int i = 0; i < count; i++) {
+      local[i] = events[(total - count + i) % events.size()];
+    }
+
+    std::vector<int> counts(clusterSize), bytes(clusterSize), displs(clusterSize);
+    MPI_Gather(&count, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::vector<DOMPTraceEvent_t> all;
+    if (rank == 0) {
+      int offset = 0;
+      for (int i = 0; i < clusterSize; i++) {
+        bytes[i] = counts[i] * sizeof(DOMPTraceEvent_t);
+        displs[i] = offset;
+        offset += bytes[i];
+      }
+      all.resize(offset / sizeof(DOMPTraceEvent_t));
+    }
+    MPI_Gatherv(local.data(), count * sizeof(DOMPTraceEvent_t), MPI_BYTE, all.data(), &bytes[0], &displs[0], MPI_BYTE,
+                0, MPI_COMM_WORLD);
+    if (rank == 0) {
+      writeTrace(all, counts, clusterSize);
+    }
+  }
+
+  // Chrome trace format, one process per node. Times are in microseconds
+  void Tracer::writeTrace(std::vector<DOMPTraceEvent_t> &all, std::vector<int> &counts, int clusterSize) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == NULL) {
+      std::cout<<"ERROR: Could not open trace file "<<path<<std::endl;
+      return;
+    }
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (int node = 0; node < clusterSize; node++) {
+      fprintf(file, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"Node %d\"}}",
+              node == 0 ? "" : ",\n", node, node);
+    }
+    int index = 0;
+    for (int node = 0; node < clusterSize; node++) {
+      for (int i = 0; i < counts[node]; i++, index++) {
+        DOMPTraceEvent_t &event = all[index];
+        fprintf(file, ",\n{\"name\": \"%s%s%s\", \"cat\": \"domp\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, ",
+                typeName(event.type), event.varName[0] ? " " : "", event.varName, node, event.thread,
+                event.start * 1e6);
+        if (event.type == TRACE_REQUEST) {
+          fprintf(file, "\"ph\": \"i\", \"s\": \"t\", \"args\": {\"%s\": %ld}}", sizeName(event.type), event.size);
+        } else {
+          fprintf(file, "\"ph\": \"X\", \"dur\": %.3f, \"args\": {\"peer\": %d, \"%s\": %ld}}",
+                  event.duration * 1e6, event.peer, sizeName(event.type), event.size);
+        }
+      }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("DOMP trace with %d events written to %s\n", index, path.c_str());
+  }
+}
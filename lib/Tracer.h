@@ -0,0 +1,90 @@
+//
+// Timeline of DOMP events on every node, written as a Chrome trace (viewable in Perfetto) at finalize.
+//
+
+#ifndef DOMP_TRACER_H
+#define DOMP_TRACER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <mpi.h>
+#include "domp.h"
+#include "util/CycleTimer.h"
+
+namespace domp {
+  class Tracer;
+  class TraceScope;
+
+  enum DOMP_TRACE_TYPE {TRACE_REQUEST = 0, TRACE_SYNC, TRACE_MAP_SEND, TRACE_MAP_RECV, TRACE_MASTER_RECV,
+                        TRACE_MASTER_PUSH, TRACE_MASTER_READ, TRACE_MASTER_UPDATE, TRACE_MASTER_SCHEDULE,
+                        TRACE_MASTER_SEND, TRACE_FETCH, TRACE_SEND, TRACE_COLLECTIVE, TRACE_BARRIER, TRACE_REDUCE,
+                        TRACE_HALO, TRACE_NUM_TYPES};
+
+  typedef struct DOMPTraceEvent {
+    // Seconds since the tracer started. Requests are instants and have no duration
+    double start;
+    double duration;
+    DOMP_TRACE_TYPE type;
+    int thread;
+    // Other node of a transfer or a map message, DOMP_INVALID_NODE if none
+    int peer;
+    // Bytes of transfers and messages, elements of requests, commands of the master phases
+    long size;
+    char varName[DOMP_MAX_VAR_NAME];
+  } DOMPTraceEvent_t;
+
+  // NULL unless tracing is enabled
+  extern Tracer *dompTracer;
+}
+
+// Enabled on all the nodes by DOMP_TRACE=<file> in the environment of the master. Events go to a fixed size ring
+// buffer, DOMP_TRACE_EVENTS of them per node (default DOMP_TRACE_DEFAULT_EVENTS). Threads claim slots with an atomic
+// counter, so recording takes no lock. When the buffer wraps the oldest events are overwritten
+#define DOMP_TRACE_DEFAULT_EVENTS (65536)
+
+class domp::Tracer {
+  int rank;
+  std::string path;
+  double origin;
+  std::vector<DOMPTraceEvent_t> events;
+  std::atomic<unsigned long> next;
+
+  static const char *typeName(DOMP_TRACE_TYPE type);
+  static const char *sizeName(DOMP_TRACE_TYPE type);
+  void writeTrace(std::vector<DOMPTraceEvent_t> &all, std::vector<int> &counts, int clusterSize);
+ public:
+  Tracer(int rank, const std::string &path);
+  // Collective. Creates dompTracer on all the nodes if the master has DOMP_TRACE set
+  static void Init(int rank);
+  void Record(DOMP_TRACE_TYPE type, const char *varName, double start, double end, int peer, long size);
+  // Collective. Gathers the events on the master, which writes the trace file
+  void Export(int clusterSize);
+};
+
+// Records an event for its lifetime. Costs one pointer check when tracing is off
+class domp::TraceScope {
+  DOMP_TRACE_TYPE type;
+  const char *varName;
+  int peer;
+  long size;
+  double start;
+ public:
+  TraceScope(DOMP_TRACE_TYPE type, const char *varName = NULL, int peer = DOMP_INVALID_NODE, long size = 0) {
+    this->type = type;
+    this->varName = varName;
+    this->peer = peer;
+    this->size = size;
+    start = (dompTracer != NULL) ? currentSeconds() : 0;
+  }
+
+  void setSize(long size) {
+    this->size = size;
+  }
+
+  ~TraceScope() {
+    if (dompTracer != NULL) dompTracer->Record(type, varName, start, currentSeconds(), peer, size);
+  }
+};
+
+#endif //DOMP_TRACER_H
@@ -0,0 +1,101 @@
+//
+// Distributed work queue used by DOMP_PARALLELIZE_DYNAMIC.
+//
+
+#include <algorithm>
+#include "WorkQueue.h"
+#include "domp.h"
+
+namespace domp {
+  WorkQueue::WorkQueue(const std::vector<std::pair<int, int> > &ranges, int chunkSize, int rank, int clusterSize) {
+    this->rank = rank;
+    this->clusterSize = clusterSize;
+    this->chunkSize = (chunkSize > 0) ? chunkSize : 1;
+    for (int i = 0; i < clusterSize; i++) {
+      queueEnd.push_back(ranges[i].first + ranges[i].second);
+    }
+    queueStart = ranges[rank].first;
+    // Start with own queue
+    victim = rank;
+    emptyQueues = 0;
+
+    // Collective call. Every node exposes the head of its own queue
+    MPI_Win_allocate(sizeof(int), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &queueHead, &window);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    *queueHead = ranges[rank].first;
+    MPI_Win_sync(window);
+    // Nobody should steal before all heads are initialized
+    MPI_Barrier(MPI_COMM_WORLD);
+    active = true;
+    log("Node %d::WorkQueue created with Start[%d], End[%d], Chunk[%d]", rank, ranges[rank].first, queueEnd[rank],
+        this->chunkSize);
+  }
+
+  WorkQueue::~WorkQueue() {
+    Release();
+  }
+
+  void WorkQueue::AddInput(char *base, int totalBytes, int itemBytes) {
+    // A single node never steals. Open MPI can't create a window of existing memory over a single process either
+    if (clusterSize == 1) return;
+    Input_t input;
+    input.base = base;
+    input.itemBytes = itemBytes;
+    MPI_Win_create(base, totalBytes, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &input.window);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, input.window);
+    inputs.push_back(input);
+  }
+
+  void WorkQueue::Release() {
+    if (!active) return;
+    // Collective call. Waits for all the nodes to drain the queues
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+    for (unsigned int i = 0; i < inputs.size(); i++) {
+      MPI_Win_unlock_all(inputs[i].window);
+      MPI_Win_free(&inputs[i].window);
+    }
+    inputs.clear();
+    active = false;
+  }
+
+  // Adjacent chunks are merged
+  static void appendChunk(std::list<std::pair<int, int> > &list, int offset, int size) {
+    if (!list.empty() && list.back().first + list.back().second == offset) {
+      list.back().second += size;
+    } else {
+      list.push_back(std::make_pair(offset, size));
+    }
+  }
+
+  bool WorkQueue::Next(int *offset, int *size) {
+    while (active && emptyQueues < clusterSize) {
+      int head;
+      MPI_Fetch_and_op(&chunkSize, &head, MPI_INT, victim, 0, MPI_SUM, window);
+      MPI_Win_flush(victim, window);
+      if (head < queueEnd[victim]) {
+        *offset = head;
+        *size = std::min(chunkSize, queueEnd[victim] - head);
+        appendChunk(chunks, *offset, *size);
+        if (victim != rank) {
+          // The node of the queue holds the inputs of its block
+          for (unsigned int i = 0; i < inputs.size(); i++) {
+            MPI_Aint displacement = (MPI_Aint) *offset * inputs[i].itemBytes;
+            int bytes = *size * inputs[i].itemBytes;
+            MPI_Get(inputs[i].base + displacement, bytes, MPI_BYTE, victim, displacement, bytes, MPI_BYTE,
+                    inputs[i].window);
+            MPI_Win_flush(victim, inputs[i].window);
+          }
+          appendChunk(stolen, *offset, *size);
+          log("Node %d::Stole chunk Offset[%d], Size[%d] from node %d", rank, *offset, *size, victim);
+        }
+        return true;
+      }
+      // This queue is empty, move to next node
+      emptyQueues++;
+      victim = (victim + 1) % clusterSize;
+    }
+    // The windows stay till the next sync, the other nodes may still be stealing
+    return false;
+  }
+}
@@ -0,0 +1,69 @@
+//
+// Distributed work queue used by DOMP_PARALLELIZE_DYNAMIC.
+//
+
+#ifndef DOMP_WORKQUEUE_H
+#define DOMP_WORKQUEUE_H
+
+#include <list>
+#include <utility>
+#include <vector>
+#include <mpi.h>
+
+namespace domp {
+  class WorkQueue;
+}
+
+// Every node starts with its static block [start, end) as its own queue. The head of every queue is kept in an
+// MPI window, so any node can take the next chunk of any queue with an atomic fetch-and-add. A node first drains its
+// own queue and then steals from the others until all of them are empty. Inputs are exposed in windows too, a stolen
+// chunk gets them from the node of the queue it was stolen from. The windows are freed by the collective Release.
+class domp::WorkQueue {
+  // Input variable exposed to the other nodes, itemBytes bytes for every index of the loop
+  typedef struct Input {
+    char *base;
+    int itemBytes;
+    MPI_Win window;
+  } Input_t;
+
+  int rank;
+  int clusterSize;
+  int chunkSize;
+  int victim;
+  int emptyQueues;
+  bool active;
+  int *queueHead;
+  MPI_Win window;
+  int queueStart;
+  std::vector<int> queueEnd;
+  std::vector<Input_t> inputs;
+  // Chunks executed by this node and the ones of them stolen from other nodes, adjacent chunks are merged
+  std::list<std::pair<int, int> > chunks;
+  std::list<std::pair<int, int> > stolen;
+
+ public:
+  WorkQueue(const std::vector<std::pair<int, int> > &ranges, int chunkSize, int rank, int clusterSize);
+  ~WorkQueue();
+  // Collective, before the first Next
+  void AddInput(char *base, int totalBytes, int itemBytes);
+  bool Next(int *offset, int *size);
+  // All the queues were empty when this node last looked, and the windows are still there
+  bool IsDrained() const {
+    return active && emptyQueues >= clusterSize;
+  }
+  // Collective
+  void Release();
+  // Own block [offset, offset + size) of this node
+  void GetOwnRange(int *offset, int *size) const {
+    *offset = queueStart;
+    *size = queueEnd[rank] - queueStart;
+  }
+  const std::list<std::pair<int, int> > &GetChunks() const {
+    return chunks;
+  }
+  const std::list<std::pair<int, int> > &GetStolen() const {
+    return stolen;
+  }
+};
+
+#endif //DOMP_WORKQUEUE_H
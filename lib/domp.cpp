@@ -4,9 +4,22 @@
 
 #include <mpi.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
+#include <sched.h>
 #include "domp.h"
 #include "DataManager.h"
+#include "WorkQueue.h"
+#include "Halo.h"
+#include "ProgressThread.h"
+#include "Tracer.h"
+#include "Imbalance.h"
+#include "PerfRegions.h"
+#include "Timers.h"
 #include "util/CycleTimer.h"
+#include "util/Numa.h"
 
 //void debug_printf(char )
 
@@ -33,6 +46,33 @@ DOMP::DOMP(int *argc, char ***argv) {
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
   dataBuffer = NULL;
+  workQueue = NULL;
+  gridRows = gridCols = 0;
+
+  // Adaptive Parallelize is collective, so the master decides for all the nodes
+  int adaptive = 0;
+  if (rank == 0) {
+    const char *partitionEnv = getenv("DOMP_PARTITION");
+    adaptive = partitionEnv != NULL && strcmp(partitionEnv, "adaptive") == 0;
+  }
+  MPI_Bcast(&adaptive, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  partitionMode = adaptive ? PARTITION_ADAPTIVE : PARTITION_STATIC;
+  partitionWeights.assign(clusterSize, 1.0 / clusterSize);
+  partitionRows = 0;
+  computeTime = 0;
+  lastSyncExit = 0;
+  intervalLibTime = 0;
+  migratePending = false;
+  layoutOffset = layoutSize = 0;
+  layoutTile[0] = layoutTile[1] = layoutTile[2] = layoutTile[3] = 0;
+  layoutVersion = 0;
+  weightsVersion = 0;
+  forOffset = forSize = 0;
+  forTotal = -1;
+  forMode = partitionMode;
+  forWeightsVersion = 0;
+  const char *numaEnv = getenv("DOMP_NUMA_THREADS");
+  numaThreads = numaEnv != NULL && strcmp(numaEnv, "1") == 0;
 
   if(void *buffer = realloc(dataBuffer, DOMP_BUFFER_INIT_SIZE)) {
     dataBuffer = buffer;
@@ -46,16 +86,198 @@ DOMP::DOMP(int *argc, char ***argv) {
   log("My rank=%d, size=%d, provided support=%d\n", rank, clusterSize, provided);
 
   MPI_Barrier(MPI_COMM_WORLD);
+  progressThread = NULL;
+  syncTicket = 0;
+  appThreads = 0;
+  const char *progressEnv = getenv("DOMP_PROGRESS_THREAD");
+  bool progressEnabled = progressEnv != NULL && strcmp(progressEnv, "1") == 0;
+  // Threads start with the cores of the thread creating them, so bind before the library creates any. Binding is
+  // collective, so the master decides for all the nodes
+  int bind = 1;
+  if (rank == 0) {
+    const char *bindEnv = getenv("DOMP_BIND");
+    bind = bindEnv == NULL || strcmp(bindEnv, "none") != 0;
+  }
+  MPI_Bcast(&bind, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (bind) {
+    bindToCores(progressEnabled && provided >= MPI_THREAD_MULTIPLE);
+  }
+  if (progressEnabled) {
+    if (provided < MPI_THREAD_MULTIPLE) {
+      std::cout<<"ERROR: DOMP_PROGRESS_THREAD needs MPI_THREAD_MULTIPLE, running without it"<<std::endl;
+    } else {
+      progressThread = new ProgressThread(rank, reserveProgressCore());
+    }
+  }
+#if PROFILING
+  imbalance = new ImbalanceProfiler();
+  asyncSyncEvent = 0;
+  // The reports are collective, so the master decides for all the nodes
+  int report = 0;
+  if (rank == 0) {
+    const char *reportEnv = getenv("DOMP_REPORT");
+    report = reportEnv != NULL && strcmp(reportEnv, "1") == 0;
+  }
+  MPI_Bcast(&report, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  reportEnabled = report != 0;
+#endif
+  Tracer::Init(rank);
+  dompTimers = new TimerRegistry(rank);
   if (rank == 0) {
     dataManager = new MasterDataManager(this, clusterSize, rank);
   } else {
     dataManager = new DataManager(this, clusterSize, rank);
   }
+  // Counts this thread, DOMP_INIT then opens the counters of the OpenMP threads. The progress thread and the mapping
+  // pool started above are not counted
+  PerfRegions::Init(rank);
+}
+
+// Split the cores this process may use among the nodes on the same machine that may use the same ones, so that nodes
+// and their threads never share a core. When the launcher already bound the nodes, for example every node to a socket,
+// the nodes with the same cores split them among themselves. Nodes whose cores overlap without being the same are
+// left as they are. A core is a physical core with all its hardware threads, cores are ordered by NUMA node first so
+// the share of a node stays on one NUMA node when it can. Hardware threads of a core only go to different nodes when
+// there are fewer physical cores than nodes. With spareCore one cpu of the share is left for the progress thread.
+// Collective over the nodes, disabled by DOMP_BIND=none in the environment of the master
+void DOMP::bindToCores(bool spareCore) {
+  MPI_Comm machineComm;
+  int localRank, localSize;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &machineComm);
+  MPI_Comm_rank(machineComm, &localRank);
+  MPI_Comm_size(machineComm, &localSize);
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  // An empty mask overlaps no other node, and this node doesn't bind
+  if (sched_getaffinity(0, sizeof(mask), &mask) != 0) CPU_ZERO(&mask);
+  std::vector<cpu_set_t> masks(localSize);
+  MPI_Allgather(&mask, sizeof(cpu_set_t), MPI_BYTE, &masks[0], sizeof(cpu_set_t), MPI_BYTE, machineComm);
+  MPI_Comm_free(&machineComm);
+  if (CPU_COUNT(&mask) == 0) return;
+
+  // Nodes with exactly these cores, and the position of this node among them
+  int sharers = 0, position = 0;
+  for (int i = 0; i < localSize; i++) {
+    if (CPU_EQUAL(&masks[i], &mask)) {
+      if (i < localRank) position++;
+      sharers++;
+      continue;
+    }
+    cpu_set_t overlap;
+    CPU_AND(&overlap, &masks[i], &mask);
+    if (CPU_COUNT(&overlap) > 0) {
+      log("Node %d::Cores overlap with local node %d without being the same, not binding", rank, i);
+      return;
+    }
+  }
+
+  // ((NUMA node, physical core), cpu), so the hardware threads of a core are next to each other
+  std::vector<std::pair<std::pair<int, int>, int> > cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &mask)) continue;
+    cpus.push_back(std::make_pair(std::make_pair(GetNumaNode(cpu), GetPhysicalCore(cpu)), cpu));
+  }
+  std::sort(cpus.begin(), cpus.end());
+  // Index of the first cpu of every unit given out, the physical cores or the cpus when there are too few cores
+  std::vector<int> units;
+  for (unsigned int i = 0; i < cpus.size(); i++) {
+    if (i == 0 || cpus[i].first != cpus[i - 1].first) units.push_back(i);
+  }
+  if ((int) units.size() < sharers) {
+    units.clear();
+    for (unsigned int i = 0; i < cpus.size(); i++) units.push_back(i);
+  }
+  int numUnits = (int) units.size();
+  if (numUnits < sharers) {
+    log("Node %d::%d cores for %d nodes sharing them, not binding", rank, numUnits, sharers);
+    return;
+  }
+  units.push_back((int) cpus.size());
+
+  // The first nodes get one more core when they don't divide evenly
+  int share = numUnits / sharers;
+  int extra = numUnits % sharers;
+  int first = position * share + std::min(position, extra);
+  int count = share + (position < extra ? 1 : 0);
+  CPU_ZERO(&mask);
+  for (int i = units[first]; i < units[first + count]; i++) {
+    CPU_SET(cpus[i].second, &mask);
+  }
+  int bound = CPU_COUNT(&mask);
+  if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+    log("Node %d::Binding to %d cpus failed", rank, bound);
+    return;
+  }
+  log("Node %d::Bound to %d of %d cores (%d cpus), %d of %d nodes sharing them", rank, count, numUnits, bound,
+      position, sharers);
+
+  // Respect an explicit thread count
+  if (getenv("OMP_NUM_THREADS") == NULL) {
+    appThreads = (spareCore && bound > 1) ? bound - 1 : bound;
+  }
+}
+
+int DOMP::GetThreadCount() {
+  return appThreads;
+}
+
+// Core for the progress thread, DOMP_PROGRESS_CORE or the last core this node may use. It is removed from the cores of
+// the calling thread, so threads created later by the application don't compete for it. -1 leaves the thread unpinned
+int DOMP::reserveProgressCore() {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (sched_getaffinity(0, sizeof(mask), &mask) != 0) return -1;
+  int core = -1;
+  const char *coreEnv = getenv("DOMP_PROGRESS_CORE");
+  if (coreEnv != NULL) {
+    core = atoi(coreEnv);
+  } else {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &mask)) core = i;
+    }
+  }
+  if (core < 0 || core >= CPU_SETSIZE || CPU_COUNT(&mask) < 2) {
+    log("Node %d::No spare core for the progress thread", rank);
+    return -1;
+  }
+  if (CPU_ISSET(core, &mask)) {
+    CPU_CLR(core, &mask);
+    sched_setaffinity(0, sizeof(mask), &mask);
+  }
+  return core;
 }
 
 DOMP::~DOMP() {
   log("Node %d destructor called", rank);
+  // Finishes the background work first, it may still use everything below
+  delete(progressThread);
+  if (dompTracer != NULL) {
+    dompTracer->Export(clusterSize);
+    delete(dompTracer);
+    dompTracer = NULL;
+  }
+  if (dompPerf != NULL) {
+    dompPerf->Report(clusterSize);
+    delete(dompPerf);
+    dompPerf = NULL;
+  }
+  dompTimers->Report(clusterSize);
+  delete(dompTimers);
+  dompTimers = NULL;
+#if PROFILING
+  if (reportEnabled) {
+    dataManager->printStatistics();
+    dataManager->printTraffic();
+  }
+#endif
   delete(dataManager);
+  delete(workQueue);
+  for (std::map<std::string, Halo*>::iterator it = haloList.begin(); it != haloList.end(); ++it)
+    delete(it->second);
+  // Memory from MPI_Alloc_mem must be released before MPI_Finalize
+  for (std::map<void*, void*>::iterator it = allocList.begin(); it != allocList.end(); ++it)
+    MPI_Free_mem(it->second);
 
   free(dataBuffer);
   currentBufferSize = 0;
@@ -63,32 +285,280 @@ DOMP::~DOMP() {
   for (std::map<std::string,Variable*>::iterator it=varList.begin(); it!=varList.end(); ++it)
     delete(it->second);
   PrintProfilingData();
+#if PROFILING
+  delete(imbalance);
+#endif
   MPI_Finalize();
 }
 
 DOMP *dompObject;
 
+// Block split of totalSize over parts, extra work is assigned to first few parts
+static void blockPartition(int totalSize, int parts, int index, int *offset, int *size) {
+  int perPart = totalSize / parts;
+  int extraWork = totalSize % parts;
+  *offset = perPart * index + ((index < extraWork) ? index : extraWork);
+  *size = perPart + ((index < extraWork) ? 1 : 0);
+}
+
+void DOMP::getPartition(int totalSize, int node, int *offset, int *size) const {
+  if (partitionMode == PARTITION_ADAPTIVE) {
+    // Boundaries are the rounded prefix sums of the weights, so sizes always add up to totalSize
+    double before = 0;
+    for (int i = 0; i < node; i++) before += partitionWeights[i];
+    double after = before + partitionWeights[node];
+    int startOffset = (int) (before * totalSize + 0.5);
+    int endOffset = (node == clusterSize - 1) ? totalSize : (int) (after * totalSize + 0.5);
+    *offset = startOffset;
+    *size = endOffset - startOffset;
+    return;
+  }
+
+  blockPartition(totalSize, clusterSize, node, offset, size);
+}
+
+bool DOMP::updatePartitionWeights() {
+  // Rows per second since last Parallelize. Zero if nothing was measured yet
+  double throughput = 0;
+  if (partitionRows > 0 && computeTime > 0) {
+    throughput = partitionRows / computeTime;
+  }
+  std::vector<double> throughputs(clusterSize);
+  MPI_Allgather(&throughput, 1, MPI_DOUBLE, &throughputs[0], 1, MPI_DOUBLE, MPI_COMM_WORLD);
+
+  double total = 0;
+  for (int i = 0; i < clusterSize; i++) {
+    // Keep the old weights till every node has a measurement
+    if (throughputs[i] <= 0) return false;
+    total += throughputs[i];
+  }
+  // Smooth with the old weights to avoid oscillation because of a single noisy phase
+  for (int i = 0; i < clusterSize; i++) {
+    partitionWeights[i] = 0.5 * partitionWeights[i] + 0.5 * throughputs[i] / total;
+  }
+  weightsVersion++;
+  return true;
+}
+
+void DOMP::SetProtocol(std::string varName, DOMP_PROTOCOL protocol) {
+  dataManager->setProtocol(varName, protocol);
+}
+
+void DOMP::SetChunkSize(int bytes) {
+  dataManager->setChunkSize(bytes);
+}
+
+void DOMP::SetChunkHook(DOMP_CHUNK_HOOK hook, void *arg) {
+  dataManager->setChunkHook(hook, arg);
+}
+
+DOMPCommStats_t DOMP::GetVariableStats(std::string varName) {
+  return dataManager->getVariableStats(varName);
+}
+
+DOMPCommStats_t DOMP::GetPeerStats(int node) {
+  return dataManager->getPeerStats(node);
+}
+
+DOMPCoherenceStats_t DOMP::GetCoherenceStats(std::string varName) {
+  return dataManager->getCoherenceStats(varName);
+}
+
+DOMPTimerStats_t DOMP::GetTimerStats(std::string name) {
+  return dompTimers->Get(name);
+}
+
+void DOMP::SetPartitionMode(DOMP_PARTITION_MODE mode) {
+  partitionMode = mode;
+}
+
 void DOMP::Parallelize(int totalSize, int *offset, int *size) {
-  int perNode = totalSize / clusterSize;
-  int startOffset = perNode * rank;
-  int extraWork = totalSize % clusterSize;
-
-  // Assign extra work to first few nodes
-  if (rank < extraWork) {
-    startOffset += rank;
-    perNode += 1;
-  } else {
-    // Adjust the offset
-    startOffset += extraWork;
+  // The progress thread may still be running collectives on MPI_COMM_WORLD
+  WaitAsync();
+  if (partitionMode == PARTITION_ADAPTIVE) {
+    // Compute since the last sync counts too, applications may not sync between two Parallelize
+    double now = libClock();
+    if (lastSyncExit > 0) {
+      computeTime += now - lastSyncExit - intervalLibTime;
+      lastSyncExit = now;
+      intervalLibTime = 0;
+    }
+    // Collective call in adaptive mode. Rows this node gets from the others are stale here when the weights moved, the
+    // exclusive requests of the next sync fetch them
+    if (updatePartitionWeights()) {
+      migratePending = true;
+    }
   }
-  *offset = startOffset;
-  *size = perNode;
+  getPartition(totalSize, rank, offset, size);
+  partitionRows = *size;
+  computeTime = 0;
+  layoutOffset = *offset;
+  layoutSize = *size;
+  layoutVersion++;
 
   log("Node %d::Parallelize returned with Offset[%d], Size[%d], TotalSize[%d]", rank, *offset, *size, totalSize);
 
 }
 
+static int gcd(int a, int b) {
+  while (b != 0) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+void DOMP::Parallelize(int totalSize, int granularity, int alignment, int *offset, int *size) {
+  if (granularity < 1) granularity = 1;
+  if (alignment < 1) alignment = 1;
+  // Smallest number of elements that is both a whole number of items and a multiple of the alignment
+  int unitElements = granularity / gcd(granularity, alignment) * alignment;
+  int unitItems = unitElements / granularity;
+  int totalUnits = (totalSize + unitItems - 1) / unitItems;
+
+  int unitOffset, unitSize;
+  Parallelize(totalUnits, &unitOffset, &unitSize);
+
+  int startItem = std::min(unitOffset * unitItems, totalSize);
+  int endItem = std::min((unitOffset + unitSize) * unitItems, totalSize);
+  *offset = startItem * granularity;
+  *size = (endItem - startItem) * granularity;
+  // The inner call recorded the layout in units, DOMP_PARALLEL_FOR loops over elements
+  layoutOffset = *offset;
+  layoutSize = *size;
+
+  log("Node %d::Parallelize returned with Offset[%d], Size[%d], TotalSize[%d], Granularity[%d], Alignment[%d]", rank,
+      *offset, *size, totalSize, granularity, alignment);
+}
+
+void DOMP::ParallelizeBlockCyclic(int totalSize, int blockSize, std::vector<std::pair<int, int> > *blocks) {
+  if (blockSize < 1) blockSize = 1;
+  blocks->clear();
+  for (int start = rank * blockSize; start < totalSize; start += clusterSize * blockSize) {
+    blocks->push_back(std::make_pair(start, std::min(blockSize, totalSize - start)));
+  }
+  log("Node %d::ParallelizeBlockCyclic returned %d blocks, TotalSize[%d], BlockSize[%d]", rank, (int) blocks->size(),
+      totalSize, blockSize);
+}
+
+void DOMP::ParallelizeDynamic(int totalSize, int chunkSize) {
+  // Static blocks are the initial queues. Idle nodes steal from the busy ones
+  std::vector<std::pair<int, int> > ranges;
+  for (int node = 0; node < clusterSize; node++) {
+    int offset, size;
+    getPartition(totalSize, node, &offset, &size);
+    ranges.push_back(std::make_pair(offset, size));
+  }
+  WaitAsync();
+  delete(workQueue);
+  dynamicInputs.clear();
+  workQueue = new WorkQueue(ranges, chunkSize, rank, clusterSize);
+}
+
+void DOMP::SharedDynamic(std::string varName, int granularity) {
+  if (workQueue == NULL) return;
+  if (varList.count(varName) == 0) {
+    log("Node %d:: Variable %s not found", rank, varName.c_str());
+    MPI_Abort(MPI_COMM_WORLD, DOMP_VAR_NOT_FOUND_ON_NODE);
+  }
+  // Creating the window is collective, it must not interleave with the collectives of background work
+  WaitAsync();
+  Variable *var = varList[varName];
+  int elementSize = getSizeBytes(var->getType());
+  workQueue->AddInput(var->getPtr(), var->getSize() * elementSize, granularity * elementSize);
+  dynamicInputs.push_back(std::make_pair(varName, granularity));
+  // The own block is where the other nodes get the inputs of the chunks they steal
+  int offset, size;
+  workQueue->GetOwnRange(&offset, &size);
+  Shared(varName, offset * granularity, size * granularity);
+}
+
+// Called by the syncs before they collect the requests. The first sync after the loop frees the windows on all the
+// nodes, and tells the directory about the inputs fetched for stolen chunks. They were copied from a current copy, and
+// nothing changes the data till this sync
+void DOMP::endDynamic() {
+  if (workQueue == NULL || !workQueue->IsDrained()) return;
+  const std::list<std::pair<int, int> > &stolen = workQueue->GetStolen();
+  for (unsigned int i = 0; i < dynamicInputs.size(); i++) {
+    int granularity = dynamicInputs[i].second;
+    for (std::list<std::pair<int, int> >::const_iterator it = stolen.begin(); it != stolen.end(); ++it) {
+      FirstShared(dynamicInputs[i].first, it->first * granularity, it->second * granularity);
+    }
+  }
+  workQueue->Release();
+}
+
+void DOMP::ParallelizeFor(int totalSize, int maxThreads) {
+  // Layouts of other Parallelize calls, like the aligned ones, are never reused
+  if (totalSize != forTotal || partitionMode != forMode || weightsVersion != forWeightsVersion) {
+    getPartition(totalSize, rank, &forOffset, &forSize);
+    forTotal = totalSize;
+    forMode = partitionMode;
+    forWeightsVersion = weightsVersion;
+  }
+  if ((int) threadNodes.size() < maxThreads) {
+    threadNodes.resize(maxThreads, -1);
+  }
+}
+
+// Called by the thread itself. The NUMA node of its first loop orders the ranges of all the later loops. With
+// DOMP_NUMA_THREADS=1 the thread is also kept on the cores of that node, so that its range stays on the memory it
+// touched like in DOMP_FIRST_TOUCH. The narrowed affinity stays after the loop
+void DOMP::SetThreadCpu(int thread, int cpu) {
+  if (thread >= (int) threadNodes.size() || threadNodes[thread] >= 0) return;
+  int node = GetNumaNode(cpu);
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (numaThreads && sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &mask) && GetNumaNode(i) != node) CPU_CLR(i, &mask);
+    }
+    if (CPU_COUNT(&mask) > 0 && sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+      log("Node %d::Thread %d could not be kept on NUMA node %d", rank, thread, node);
+    }
+  }
+  threadNodes[thread] = node;
+}
+
+int DOMP::ThreadRange(int thread, int numThreads, int *end) {
+  // Threads are ordered by NUMA node, then by thread number
+  int node = (thread < (int) threadNodes.size()) ? std::max(threadNodes[thread], 0) : 0;
+  int position = 0;
+  for (int other = 0; other < numThreads; other++) {
+    int otherNode = (other < (int) threadNodes.size()) ? std::max(threadNodes[other], 0) : 0;
+    if (otherNode < node || (otherNode == node && other < thread)) position++;
+  }
+  int begin = forOffset + (int) ((long) forSize * position / numThreads);
+  *end = forOffset + (int) ((long) forSize * (position + 1) / numThreads);
+  return begin;
+}
+
+int DOMP::GetForOffset() {
+  return forOffset;
+}
+
+int DOMP::GetForSize() {
+  return forSize;
+}
+
+bool DOMP::NextChunk(int *offset, int *size) {
+  if (workQueue == NULL) return false;
+  return workQueue->Next(offset, size);
+}
+
+void DOMP::ExclusiveDynamic(std::string varName, int granularity) {
+  if (workQueue == NULL) return;
+  // Placement of the dynamic loop is known only now, so record it in the directory with the next sync
+  const std::list<std::pair<int, int> > &chunks = workQueue->GetChunks();
+  for (std::list<std::pair<int, int> >::const_iterator it = chunks.begin(); it != chunks.end(); ++it) {
+    Exclusive(varName, it->first * granularity, it->second * granularity);
+  }
+}
+
 void DOMP::Register(std::string varName, void *varValue, MPI_Datatype type, int size) {
+  // A background sync may be mapping the variables of the master
+  WaitAsync();
   if (varList.count(varName) != 0) {
     delete(varList[varName]);
   }
@@ -99,28 +569,224 @@ void DOMP::Register(std::string varName, void *varValue, MPI_Datatype type, int
   }
 }
 
+void DOMP::Register2D(std::string varName, void *varValue, MPI_Datatype type, int rows, int cols) {
+  // A background sync may be mapping the variables of the master
+  WaitAsync();
+  if (varList.count(varName) != 0) {
+    delete(varList[varName]);
+  }
+  varList[varName] =  new Variable((char*)varValue, type, rows * cols, cols);
+  log("Node %d registered 2D Var[%s] Address[%p] Rows[%d] Cols[%d]", rank, varName.c_str(), varValue, rows, cols);
+  if (IsMaster()) {
+    dataManager->registerVariable(varName, varList[varName]);
+  }
+}
+
+void DOMP::Unregister(std::string varName) {
+  if (varList.count(varName) == 0) return;
+  WaitAsync();
+  delete(varList[varName]);
+  varList.erase(varName);
+  if (haloList.count(varName) != 0) {
+    delete(haloList[varName]);
+    haloList.erase(varName);
+  }
+  if (IsMaster()) {
+    dataManager->unregisterVariable(varName);
+  }
+  log("Node %d unregistered Var[%s]", rank, varName.c_str());
+}
+
+void *DOMP::Alloc(std::string varName, MPI_Datatype type, int size, int cols) {
+  long bytes = (long) size * getSizeBytes(type);
+  // Whole huge pages, so that madvise covers all of it
+  long alignedBytes = (bytes + DOMP_HUGE_PAGE_SIZE - 1) / DOMP_HUGE_PAGE_SIZE * DOMP_HUGE_PAGE_SIZE;
+  if (alignedBytes == 0) alignedBytes = DOMP_HUGE_PAGE_SIZE;
+
+  // Ask for the alignment first. Implementations that ignore the hint get a bigger block that is aligned here
+  char alignment[16];
+  snprintf(alignment, sizeof(alignment), "%d", DOMP_HUGE_PAGE_SIZE);
+  MPI_Info info;
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "mpi_minimum_memory_alignment", alignment);
+  void *base = NULL;
+  if (MPI_Alloc_mem(alignedBytes, info, &base) != MPI_SUCCESS) base = NULL;
+  if (base != NULL && ((size_t) base % DOMP_HUGE_PAGE_SIZE) != 0) {
+    MPI_Free_mem(base);
+    if (MPI_Alloc_mem(alignedBytes + DOMP_HUGE_PAGE_SIZE, info, &base) != MPI_SUCCESS) base = NULL;
+  }
+  MPI_Info_free(&info);
+  if (base == NULL) {
+    log("Node %d::MPI_Alloc_mem failed for Var[%s], Bytes[%ld]", rank, varName.c_str(), alignedBytes);
+    throw std::bad_alloc();
+  }
+  char *ptr = (char *) (((size_t) base + DOMP_HUGE_PAGE_SIZE - 1) / DOMP_HUGE_PAGE_SIZE * DOMP_HUGE_PAGE_SIZE);
+
+  const char *hugePagesEnv = getenv("DOMP_HUGEPAGES");
+  if (hugePagesEnv == NULL || strcmp(hugePagesEnv, "0") != 0) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(ptr, alignedBytes, MADV_HUGEPAGE) != 0) {
+      log("Node %d::madvise(MADV_HUGEPAGE) failed for Var[%s]", rank, varName.c_str());
+    }
+#endif
+  }
+  allocList[ptr] = base;
+  log("Node %d::Allocated Var[%s] Address[%p] Bytes[%ld]", rank, varName.c_str(), ptr, bytes);
+
+  if (cols > 0) {
+    Register2D(varName, ptr, type, size / cols, cols);
+  } else {
+    Register(varName, ptr, type, size);
+  }
+  return ptr;
+}
+
+void DOMP::Free(std::string varName, void *ptr) {
+  WaitAsync();
+  // Memory of DOMP_REGISTER stays registered, its owner keeps using it
+  if (allocList.count(ptr) == 0) {
+    std::cout<<"ERROR: DOMP_FREE called on memory not allocated by DOMP_ALLOC"<<std::endl;
+    return;
+  }
+  Unregister(varName);
+  MPI_Free_mem(allocList[ptr]);
+  allocList.erase(ptr);
+}
+
+void DOMP::CreateGrid(int rows, int cols) {
+  if (rows <= 0 || cols <= 0 || rows * cols != clusterSize) {
+    // Most square factorization, with rows <= cols
+    rows = 1;
+    for (int i = 1; i * i <= clusterSize; i++) {
+      if (clusterSize % i == 0) rows = i;
+    }
+    cols = clusterSize / rows;
+  }
+  gridRows = rows;
+  gridCols = cols;
+  log("Node %d::Grid created with Rows[%d], Cols[%d], Position[%d, %d]", rank, gridRows, gridCols, GetGridRow(),
+      GetGridCol());
+}
+
+int DOMP::GetGridRow() {
+  if (gridRows == 0) CreateGrid(0, 0);
+  return rank / gridCols;
+}
+
+int DOMP::GetGridCol() {
+  if (gridRows == 0) CreateGrid(0, 0);
+  return rank % gridCols;
+}
+
+int DOMP::GetGridRows() {
+  if (gridRows == 0) CreateGrid(0, 0);
+  return gridRows;
+}
+
+int DOMP::GetGridCols() {
+  if (gridRows == 0) CreateGrid(0, 0);
+  return gridCols;
+}
+
+void DOMP::Parallelize2D(int rows, int cols, int *rowOffset, int *rowSize, int *colOffset, int *colSize) {
+  blockPartition(rows, GetGridRows(), GetGridRow(), rowOffset, rowSize);
+  blockPartition(cols, GetGridCols(), GetGridCol(), colOffset, colSize);
+  layoutTile[0] = *rowOffset;
+  layoutTile[1] = *rowSize;
+  layoutTile[2] = *colOffset;
+  layoutTile[3] = *colSize;
+  layoutVersion++;
+  log("Node %d::Parallelize2D returned with Rows[%d, %d], Cols[%d, %d]", rank, *rowOffset, *rowSize, *colOffset,
+      *colSize);
+}
+
+int DOMP::getCols(std::string varName) {
+  // Called by the tile requests, possibly from several threads. Only find is safe for concurrent readers
+  std::map<std::string, Variable*>::iterator it = varList.find(varName);
+  if (it == varList.end() || it->second->getCols() == 0) {
+    log("Node %d:: 2D Variable %s not found", rank, varName.c_str());
+    MPI_Abort(MPI_COMM_WORLD, DOMP_VAR_NOT_FOUND_ON_NODE);
+  }
+  return it->second->getCols();
+}
+
+void DOMP::SharedTile(std::string varName, int rowOffset, int rowSize, int colOffset, int colSize) {
+  int cols = getCols(varName);
+  dataManager->requestData(varName, rowOffset * cols + colOffset, colSize, MPI_SHARED_FETCH, rowSize, cols);
+}
+
+void DOMP::ExclusiveTile(std::string varName, int rowOffset, int rowSize, int colOffset, int colSize) {
+  int cols = getCols(varName);
+  dataManager->requestData(varName, rowOffset * cols + colOffset, colSize, MPI_EXCLUSIVE_FIRST, rowSize, cols);
+}
+
+void DOMP::HaloExchange(std::string varName, int width, bool periodic) {
+  if (varList.count(varName) == 0) {
+    log("Node %d:: Variable %s not found", rank, varName.c_str());
+    MPI_Abort(MPI_COMM_WORLD, DOMP_VAR_NOT_FOUND_ON_NODE);
+  }
+  // Setting up a halo is collective, it must not interleave with the collectives of background work
+  WaitAsync();
+  TraceScope trace(TRACE_HALO, varName.c_str());
+  double start = libClock();
+  Halo *halo = haloList.count(varName) ? haloList[varName] : NULL;
+  if (halo == NULL || !halo->Matches(width, periodic, layoutVersion)) {
+    // All the nodes see the same layout changes, so they rebuild together
+    delete(halo);
+    Variable *var = varList[varName];
+    int elementSize = getSizeBytes(var->getType());
+    halo = new Halo(width, periodic, layoutVersion, rank, clusterSize);
+    if (var->getCols() == 0) {
+      halo->Setup1D(var->getPtr(), elementSize, var->getSize(), layoutOffset, layoutSize);
+    } else {
+      halo->Setup2D(var->getPtr(), elementSize, var->getCols(), GetGridRows(), GetGridCols(), layoutTile[0],
+                    layoutTile[1], layoutTile[2], layoutTile[3]);
+    }
+    haloList[varName] = halo;
+  }
+  halo->Exchange();
+  const std::vector<HaloTraffic_t> &traffic = halo->GetTraffic();
+  for (unsigned int i = 0; i < traffic.size(); i++) {
+    dataManager->countTransfer(varName.c_str(), traffic[i].peer, true, traffic[i].sendBytes, 1);
+    dataManager->countTransfer(varName.c_str(), traffic[i].peer, false, traffic[i].recvBytes, 1);
+  }
+  // Exchange time counts as library time, like the syncs
+  intervalLibTime += libClock() - start;
+#if PROFILING
+  profiler.syncTime += libClock() - start;
+#endif
+}
+
 void DOMP::FirstShared(std::string varName, int offset, int size) {
   dataManager->requestData(varName, offset, size, MPI_SHARED_FIRST);
 }
 
 void DOMP::Shared(std::string varName, int offset, int size) {
-  dataManager->requestData(varName, offset, size, MPI_EXCLUSIVE_FETCH);
+  // Readers are added to the holders of the data, nobody loses its copy
+  dataManager->requestData(varName, offset, size, MPI_SHARED_FETCH);
 }
 
 void DOMP::Exclusive(std::string varName, int offset, int size) {
+  // The read is planned before the write, parts this node already has are hits
+  if (migratePending) {
+    dataManager->requestData(varName, offset, size, MPI_SHARED_FETCH);
+  }
   dataManager->requestData(varName, offset, size, MPI_EXCLUSIVE_FIRST);
 }
 
-void DOMP::Reduce(std::string varName, void *address, MPI_Datatype type, MPI_Op op) {
-  ArrayReduce(varName, address, type, op, 0, 1, REDUCE_ON_MASTER);
+void DOMP::Reduce(std::string varName, void *address, MPI_Datatype type, MPI_Op op, const char *file, int line) {
+  ArrayReduce(varName, address, type, op, 0, 1, REDUCE_ON_MASTER, file, line);
 }
 
 
 void DOMP::ArrayReduce(std::string varName, void *address, MPI_Datatype type, MPI_Op op, int offset, int size,
-                      DOMP_REDUCE_TYPE reduceType) {
+                      DOMP_REDUCE_TYPE reduceType, const char *file, int line) {
   log("Node %d::Called ArrayReduce with address %p", rank, address);
+  WaitAsync();
+  TraceScope trace(TRACE_REDUCE, varName.c_str(), DOMP_INVALID_NODE, (long) size * getSizeBytes(type));
+  double start = libClock();
 #if PROFILING
-  double start = currentSeconds();
+  int event = imbalance->Arrive(file, line, start);
 #endif
   int varSize = getSizeBytes(type);
   int totalSize =  varSize * size;
@@ -138,30 +804,148 @@ void DOMP::ArrayReduce(std::string varName, void *address, MPI_Datatype type, MP
   void *dataPtr = (char*)address + (offset * varSize);
   log("Node %d calling ArrayReduce on %s and address %p, pointer %p, size=%d",rank, varName.c_str(), dataPtr,
       dataBuffer, size);
+#if PROFILING
+  double collectiveStart = currentSeconds();
+#endif
   if (reduceType == REDUCE_ON_MASTER) {
     MPI_Reduce(dataPtr, dataBuffer, size, type, op, 0, MPI_COMM_WORLD);
   } else {
     MPI_Allreduce(dataPtr, dataBuffer, size, type, op, MPI_COMM_WORLD);
   }
+#if PROFILING
+  imbalance->AddWait(event, currentSeconds() - collectiveStart);
+#endif
   memcpy(dataPtr, dataBuffer, totalSize);
+  // Reductions are not part of the compute phase measured for adaptive partitioning
+  intervalLibTime += libClock() - start;
 #if PROFILING
-  profiler.reduceTime += currentSeconds() - start;
+  profiler.reduceTime += libClock() - start;
+  imbalance->Leave(event, libClock());
 #endif
   log("Node %d returned ArrayReduce on %s",rank, varName.c_str());
 }
 
-void DOMP::Synchronize() {
+void DOMP::ArrayReduceBegin(std::string varName, void *address, MPI_Datatype type, MPI_Op op, int offset, int size,
+                           DOMP_REDUCE_TYPE reduceType, const char *file, int line) {
+  if (progressThread == NULL) {
+    ArrayReduce(varName, address, type, op, offset, size, reduceType, file, line);
+    return;
+  }
+#if PROFILING
+  // Waiting for it is part of the next blocking call
+  double now = libClock();
+  imbalance->Leave(imbalance->Arrive(file, line, now), now);
+#endif
+  log("Node %d::Started background ArrayReduce on %s", rank, varName.c_str());
+  // In place, so that reductions in flight don't share the reduce buffer
+  void *dataPtr = (char*)address + (offset * getSizeBytes(type));
+  bool isRoot = IsMaster();
+  long bytes = (long) size * getSizeBytes(type);
+  progressThread->Submit([dataPtr, size, type, op, reduceType, isRoot, bytes]() {
+    TraceScope trace(TRACE_REDUCE, NULL, DOMP_INVALID_NODE, bytes);
+    if (reduceType == REDUCE_ALL) {
+      MPI_Allreduce(MPI_IN_PLACE, dataPtr, size, type, op, MPI_COMM_WORLD);
+    } else if (isRoot) {
+      MPI_Reduce(MPI_IN_PLACE, dataPtr, size, type, op, 0, MPI_COMM_WORLD);
+    } else {
+      MPI_Reduce(dataPtr, NULL, size, type, op, 0, MPI_COMM_WORLD);
+    }
+  });
+}
+
+void DOMP::WaitAsync() {
+  if (progressThread == NULL || progressThread->Idle()) return;
+  double start = libClock();
+  progressThread->WaitAll();
+  intervalLibTime += libClock() - start;
+#if PROFILING
+  profiler.syncTime += libClock() - start;
+#endif
+}
+
+// Time for the profiler and the throughput of adaptive partitioning. Without either the syncs don't read the clock
+double DOMP::libClock() const {
+#if PROFILING
+  return currentSeconds();
+#else
+  return (partitionMode == PARTITION_ADAPTIVE) ? currentSeconds() : 0;
+#endif
+}
+
+void DOMP::Synchronize(const char *file, int line) {
   log("Node %d calling sync",rank);
+  double start = libClock();
 #if PROFILING
-  double start = currentSeconds();
+  int event = imbalance->Arrive(file, line, start);
 #endif
-  dataManager->triggerMap();
+  WaitAsync();
+  if (lastSyncExit > 0) {
+    computeTime += start - lastSyncExit - intervalLibTime;
+  }
+  endDynamic();
+  dataManager->collectRequests();
+  migratePending = false;
+  {
+    TraceScope trace(TRACE_SYNC);
+    dataManager->triggerMap();
+  }
+  lastSyncExit = libClock();
+  intervalLibTime = 0;
 #if PROFILING
-  profiler.syncTime += currentSeconds() - start;
+  profiler.syncTime += lastSyncExit - start;
+  imbalance->AddWait(event, dataManager->getBlockedTime());
+  imbalance->Leave(event, lastSyncExit);
 #endif
   log("Node %d returned sync",rank);
 }
 
+void DOMP::SynchronizeBegin(const char *file, int line) {
+  if (progressThread == NULL) {
+    Synchronize(file, line);
+    return;
+  }
+  log("Node %d calling background sync",rank);
+  double start = libClock();
+#if PROFILING
+  asyncSyncEvent = imbalance->Arrive(file, line, start);
+#endif
+  // The previous sync must be done with the collected requests before they are replaced
+  WaitAsync();
+  if (lastSyncExit > 0) {
+    computeTime += start - lastSyncExit - intervalLibTime;
+  }
+  endDynamic();
+  dataManager->collectRequests();
+  migratePending = false;
+  DataManager *manager = dataManager;
+  syncTicket = progressThread->Submit([manager]() {
+    TraceScope trace(TRACE_SYNC);
+    manager->triggerMap();
+  });
+  // Computation until SynchronizeEnd counts as compute time of the next interval, only the waiting is library time
+  lastSyncExit = libClock();
+  intervalLibTime = 0;
+#if PROFILING
+  profiler.syncTime += lastSyncExit - start;
+  imbalance->Leave(asyncSyncEvent, lastSyncExit);
+#endif
+}
+
+void DOMP::SynchronizeEnd() {
+  if (progressThread == NULL) return;
+  double start = libClock();
+  progressThread->Wait(syncTicket);
+  double waited = libClock() - start;
+  intervalLibTime += waited;
+#if PROFILING
+  profiler.syncTime += waited;
+  // The sync ran in the background, only the time the application waits for it here is blocked
+  imbalance->AddTime(asyncSyncEvent, waited);
+  imbalance->AddWait(asyncSyncEvent, waited);
+#endif
+  log("Node %d returned background sync",rank);
+}
+
 bool DOMP::IsMaster() {
   if (rank == 0) return true;
   else return false;
@@ -232,13 +1016,18 @@ void DOMP::PrintProfilingData() {
     printf("DOMP Slave Total time = %10.4f sec\n", slaveTotalTime);
     printf("DOMP Cluster Size = %d\n", clusterSize);
   }
+  if (reportEnabled) {
+    imbalance->Report(rank, clusterSize);
+  }
 #endif
 }
 
 void DOMP::InitProfiler() {
+#if PROFILING
   this->profiler.programStart = currentSeconds();
   this->profiler.syncTime = 0;
   this->profiler.reduceTime = 0;
+#endif
 }
 
 }
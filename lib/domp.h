@@ -9,9 +9,15 @@
 #include <set>
 #include <list>
 #include <map>
+#include <vector>
 
 #include <mpi.h>
 #include <stdbool.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#include <sched.h>
+#endif
 #include "util/CycleTimer.h"
 
 namespace domp {
@@ -19,27 +25,112 @@ namespace domp {
   #define DOMP_MAX_CLUSTER_NAME (10)
   #define DOMP_BUFFER_INIT_SIZE (256)
   #define DOMP_MAX_CLIENT_NAME (DOMP_MAX_CLUSTER_NAME + 10)
+  #define DOMP_CACHE_LINE_SIZE (64)
+  #define DOMP_SIMD_WIDTH (32)
+  #define DOMP_PAGE_SIZE (4096)
+  #define DOMP_INVALID_NODE (-1)
+  #define DOMP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+  // Number of elements of ctype in given bytes, to be used as alignment for DOMP_PARALLELIZE_ALIGNED
+  #define DOMP_ALIGN_ELEMENTS(bytes, ctype) ((int) ((bytes) / sizeof(ctype)))
 
   enum DOMP_TYPE {DOMP_INT, DOMP_FLOAT};
   enum DOMP_REDUCE_OP {DOMP_ADD, DOMP_SUBTRACT};
   enum DOMP_REDUCE_TYPE {REDUCE_ON_MASTER, REDUCE_ALL};
+  enum DOMP_PARTITION_MODE {PARTITION_STATIC, PARTITION_ADAPTIVE};
+  enum DOMP_PROTOCOL {PROTOCOL_INVALIDATE, PROTOCOL_UPDATE};
 
   enum DOMP_ERROR_MSG {
     DOMP_VAR_NOT_FOUND_ON_NODE,
-    DOMP_VAR_NOT_FOUND_ON_MASTER
+    DOMP_VAR_NOT_FOUND_ON_MASTER,
+    DOMP_PROBE_FAILED
   };
 
   class DOMP;
   class DataManager;
   class Variable;
   class Profiler;
+  class WorkQueue;
+  class Halo;
+  class ProgressThread;
+  class ImbalanceProfiler;
+  class PerfRegions;
+  class PerfScope;
+  class TimerRegistry;
+  class ScopedTimer;
+
+  // Called on the receiving node when a chunk of a fetched range has arrived, from inside DOMP_SYNC
+  typedef void (*DOMP_CHUNK_HOOK)(const char *varName, void *address, int bytes, void *arg);
+
+  // Data traffic of this node since DOMP_INIT, for a variable or a peer. Covers the transfers of the syncs and the
+  // halo exchanges, not the reductions
+  typedef struct DOMPCommStats {
+    long bytesSent;
+    long bytesReceived;
+    // A transfer sent in chunks is one fragment of several messages
+    long messagesSent;
+    long messagesReceived;
+    long fragmentsSent;
+    long fragmentsReceived;
+    // Requests made with DOMP_SHARED, DOMP_EXCLUSIVE and their tile versions. Per peer, the requests a node sent to
+    // the master, or on the master the requests it received from the node
+    long mapCommands;
+  } DOMPCommStats_t;
+
+  // Coherence counters of a variable in the directory of the master. Counts are per fragment (or tile) and node
+  typedef struct DOMPCoherenceStats {
+    // Copies made stale by a write under the invalidate protocol
+    long invalidations;
+    // Copies pushed under the update protocol, and their total number of elements
+    long updates;
+    long updateElements;
+    // Fetch requests served by an already current copy, and the ones that needed a transfer
+    long hits;
+    long misses;
+    // Pushed copies that were written again before any request used them
+    long wasted;
+  } DOMPCoherenceStats_t;
+
+  // Powers of two microseconds. The first bucket is below 1us, bucket b above it starts at 2^(b-1) us
+  #define DOMP_TIMER_BUCKETS (32)
+
+  // Durations of a named timer on this node, from DOMP_TIMER_STATS
+  typedef struct DOMPTimerStats {
+    long count;
+    double total;
+    double min;
+    double max;
+    long buckets[DOMP_TIMER_BUCKETS];
+  } DOMPTimerStats_t;
 
 void log(const char *fmt, ...);
   extern DOMP *dompObject;
+  // NULL unless the regions are enabled
+  extern PerfRegions *dompPerf;
+  void PerfRegionBegin(const char *name);
+  void PerfRegionEnd(const char *name);
+  void PerfRegionOpenThread();
+  // Created by DOMP_INIT
+  extern TimerRegistry *dompTimers;
+  void RecordTimer(const char *name, double seconds);
 
+  // Binds every node to its own share of the cores of its machine, see DOMP::bindToCores. The OpenMP runtime sizes its
+  // thread pool before DOMP_INIT runs, so the thread count is set here to the cores of the node. Hardware counters
+  // only see the thread opening them, so every thread of the pool opens its own
+#ifdef _OPENMP
   #define DOMP_INIT(argc, argv) { \
     dompObject = new DOMP(argc, argv); \
+    if (dompObject->GetThreadCount() > 0) omp_set_num_threads(dompObject->GetThreadCount()); \
+    if (domp::dompPerf != NULL) { \
+      DOMP_PRAGMA(omp parallel) \
+      domp::PerfRegionOpenThread(); \
+    } \
   }
+#else
+  #define DOMP_INIT(argc, argv) { \
+    dompObject = new DOMP(argc, argv); \
+  }
+#endif
 
   #define DOMP_NODE_ID (dompObject->GetRank())
   #define DOMP_CLUSTER_SIZE (dompObject->GetClusterSize())
@@ -47,30 +138,219 @@ void log(const char *fmt, ...);
   #define DOMP_REGISTER(var, type, size) { \
     dompObject->Register(#var, var, type, size); \
   }
+  // Allocate size elements of type for var and register it. The memory is aligned to DOMP_HUGE_PAGE_SIZE, comes from
+  // MPI_Alloc_mem so the transport can register it for RMA, and is backed by transparent huge pages unless
+  // DOMP_HUGEPAGES=0 is set in the environment. Pages are not touched, so they are placed by the first thread using them
+  #define DOMP_ALLOC(var, type, size) { \
+    var = (decltype(var)) dompObject->Alloc(#var, type, size); \
+  }
+
+  #define DOMP_ALLOC_2D(var, type, rows, cols) { \
+    var = (decltype(var)) dompObject->Alloc(#var, type, (rows) * (cols), cols); \
+  }
+
+  // Unregister var and release memory from DOMP_ALLOC
+  #define DOMP_FREE(var) { \
+    dompObject->Free(#var, var); \
+    var = NULL; \
+  }
+
   #define DOMP_PARALLELIZE(var, offset, size) { \
     dompObject->Parallelize(var, offset, size); \
   }
 
+  // var items of granularity elements each. Offset and size are in elements and every boundary between two nodes is a
+  // multiple of alignment elements
+  #define DOMP_PARALLELIZE_ALIGNED(var, granularity, alignment, offset, size) { \
+    dompObject->Parallelize(var, granularity, alignment, offset, size); \
+  }
+
+  // Round robin blocks of blockSize elements. blocks is a std::vector<std::pair<int, int> > of (offset, size). The
+  // directory doesn't know this layout, so DOMP_SHARED and DOMP_EXCLUSIVE must be called for every block, and
+  // DOMP_PARALLEL_FOR and DOMP_HALO don't use it
+  #define DOMP_PARALLELIZE_CYCLIC(var, blockSize, blocks) { \
+    dompObject->ParallelizeBlockCyclic(var, blockSize, blocks); \
+  }
+
+  // Adaptive mode re-weights every Parallelize by the compute throughput measured outside the library since the
+  // previous Parallelize, so applications re-partition now and then to use it. Rows that change owner move with the
+  // first sync after the re-partition, in it DOMP_EXCLUSIVE also fetches the rows its node didn't have. It can also be
+  // enabled without code changes by setting DOMP_PARTITION=adaptive in the environment of the master
+  #define DOMP_SET_PARTITION(mode) { \
+    dompObject->SetPartitionMode(mode); \
+  }
+
+  // Dynamic distribution. Keep calling DOMP_NEXT_CHUNK until it returns false on every node, then DOMP_SYNC, which
+  // ends the loop on all the nodes. Any node can run any chunk. Inputs are declared with DOMP_SHARED_DYNAMIC before
+  // the loop and outputs are placed with DOMP_EXCLUSIVE_DYNAMIC after it
+  #define DOMP_PARALLELIZE_DYNAMIC(var, chunkSize) { \
+    dompObject->ParallelizeDynamic(var, chunkSize); \
+  }
+
+  // Input of the dynamic loop, granularity elements of var for every index. Collective, after DOMP_PARALLELIZE_DYNAMIC
+  // and before a DOMP_SYNC that comes ahead of the loop. That sync brings every node the inputs of its own block, and a
+  // chunk stolen in the loop gets them from the node it was stolen from. The sync ending the loop records the stolen
+  // inputs in the directory, so later DOMP_SHARED requests for them don't fetch again
+  #define DOMP_SHARED_DYNAMIC(var, granularity) { \
+    dompObject->SharedDynamic(#var, granularity); \
+  }
+
+  #define DOMP_NEXT_CHUNK(offset, size) (dompObject->NextChunk(offset, size))
+
+  #define DOMP_PRAGMA(...) _Pragma(#__VA_ARGS__)
+
+  // Loop over the part of [0, totalSize) owned by this node, split over the threads of the node. The part is the one
+  // DOMP_PARALLELIZE of totalSize returns with the current weights, the loop keeps it till the total, the partition
+  // mode or the weights change. Not collective, it never re-weights itself. Threads on the same NUMA node get adjacent
+  // ranges, and a thread gets the same range in every loop of the same totalSize. With DOMP_NUMA_THREADS=1 in the
+  // environment a thread is also kept on the cores of its NUMA node from its first loop on, which narrows the binding
+  // of the node for good. Optional OpenMP clauses like reduction(+ : sum) go last. Must be used as a statement on its
+  // own, not as the body of an if or a loop without braces
+#ifdef _OPENMP
+  #define DOMP_PARALLEL_FOR(index, totalSize, ...) \
+    dompObject->ParallelizeFor(totalSize, omp_get_max_threads()); \
+    DOMP_PRAGMA(omp parallel __VA_ARGS__) \
+    for (int index##End, index = domp::ThreadRange(&index##End); index < index##End; index++)
+#else
+  #define DOMP_PARALLEL_FOR(index, totalSize, ...) \
+    dompObject->ParallelizeFor(totalSize, 1); \
+    for (int index##End, index = dompObject->ThreadRange(0, 1, &index##End); index < index##End; index++)
+#endif
+
+  // Zero the part of var owned by this node with the threads of DOMP_PARALLEL_FOR, so that every page is placed on
+  // the NUMA node of the thread that will use it. The thread stays there with DOMP_NUMA_THREADS=1. For memory not
+  // touched yet, like from DOMP_ALLOC
+  #define DOMP_FIRST_TOUCH(var, totalSize) { \
+    DOMP_PARALLEL_FOR(dompTouchIndex, totalSize) { \
+      memset(&(var)[dompTouchIndex], 0, sizeof(*(var))); \
+    } \
+  }
+
+  #define DOMP_FOR_OFFSET (dompObject->GetForOffset())
+  #define DOMP_FOR_SIZE (dompObject->GetForSize())
+
+  // Request exclusive access of var for all the chunks executed by this node in last dynamic loop
+  #define DOMP_EXCLUSIVE_DYNAMIC(var, granularity) { \
+    dompObject->ExclusiveDynamic(#var, granularity); \
+  }
+
+  // 2D variables are row major matrices of rows x cols elements. Their directory tracks rectangular tiles
+  #define DOMP_REGISTER_2D(var, type, rows, cols) { \
+    dompObject->Register2D(#var, var, type, rows, cols); \
+  }
+
+  // Arrange the nodes as a rows x cols process grid. Zero for both picks the most square grid
+  #define DOMP_GRID(rows, cols) { \
+    dompObject->CreateGrid(rows, cols); \
+  }
+
+  #define DOMP_GRID_ROW (dompObject->GetGridRow())
+  #define DOMP_GRID_COL (dompObject->GetGridCol())
+  #define DOMP_GRID_ROWS (dompObject->GetGridRows())
+  #define DOMP_GRID_COLS (dompObject->GetGridCols())
+
+  // Block of a rows x cols matrix owned by this node on the process grid
+  #define DOMP_PARALLELIZE_2D(rows, cols, rowOffset, rowSize, colOffset, colSize) { \
+    dompObject->Parallelize2D(rows, cols, rowOffset, rowSize, colOffset, colSize); \
+  }
+
+  #define DOMP_SHARED_TILE(var, rowOffset, rowSize, colOffset, colSize) { \
+    dompObject->SharedTile(#var, rowOffset, rowSize, colOffset, colSize); \
+  }
+
+  #define DOMP_EXCLUSIVE_TILE(var, rowOffset, rowSize, colOffset, colSize) { \
+    dompObject->ExclusiveTile(#var, rowOffset, rowSize, colOffset, colSize); \
+  }
+
+  // Exchange width ghost cells of var with the neighbours in the layout of the last DOMP_PARALLELIZE (or
+  // DOMP_PARALLELIZE_2D for 2D variables). Collective call, the exchange is set up on first use
+  #define DOMP_HALO(var, width) { \
+    dompObject->HaloExchange(#var, width, false); \
+  }
+
+  // Same, but the first and the last blocks are neighbours too
+  #define DOMP_HALO_PERIODIC(var, width) { \
+    dompObject->HaloExchange(#var, width, true); \
+  }
+
+  // Coherence protocol of var. Invalidate (default) drops the other copies on a write, so readers fetch again. Update
+  // pushes every new version to the nodes that had a copy at the next sync, so their reads need no transfer. Any node
+  // can change it, the change is sent with its requests and applies from the next sync on. The hits, misses and pushes
+  // of every variable are printed at finalize with DOMP_REPORT=1
+  #define DOMP_SET_PROTOCOL(var, protocol) { \
+    dompObject->SetProtocol(#var, protocol); \
+  }
+
+  // DOMPCoherenceStats_t of var so far. Only the master keeps the directory, the other nodes read zeros. Must not be
+  // read while a split phase sync is in flight
+  #define DOMP_COHERENCE_STATS(var) (dompObject->GetCoherenceStats(#var))
+
+  // Bytes per chunk of large transfers, zero sends every transfer as one message. Must be the same on all the nodes,
+  // also set by DOMP_CHUNK_SIZE in the environment of the master
+  #define DOMP_SET_CHUNK_SIZE(bytes) { \
+    dompObject->SetChunkSize(bytes); \
+  }
+
+  #define DOMP_SET_CHUNK_HOOK(hook, arg) { \
+    dompObject->SetChunkHook(hook, arg); \
+  }
+
+  // DOMPCommStats_t of this node for var or for another node. Must not be read while a split phase sync is in flight.
+  // With DOMP_REPORT=1 in the environment, profiling builds print the totals of every variable and the traffic matrix
+  // of the cluster at finalize
+  #define DOMP_VAR_STATS(var) (dompObject->GetVariableStats(#var))
+  #define DOMP_PEER_STATS(node) (dompObject->GetPeerStats(node))
+
+  // DOMP_SHARED, DOMP_EXCLUSIVE and their tile versions can be called by several threads at once, for example inside
+  // #pragma omp parallel. The requests of all the threads are collected by the next DOMP_SYNC, called by one thread
   #define DOMP_SHARED(var, offset, size) { \
     dompObject->Shared(#var, offset, size); \
   }
 
+  // A node that fetched a range keeps its copy, and later syncs don't fetch it again, until some node declares the
+  // range exclusive again. So every epoch that writes a range must declare DOMP_EXCLUSIVE (or DOMP_EXCLUSIVE_TILE) on
+  // it again, in the sync right before the writes or the one right after them. Declaring it once and writing it in
+  // later epochs leaves stale copies on the readers
   #define DOMP_EXCLUSIVE(var, offset, size) { \
     dompObject->Exclusive(#var, offset, size); \
   }
 
-  #define DOMP_SYNC { dompObject->Synchronize(); }
+  // Syncs and reductions pass their source location. With DOMP_REPORT=1, profiling builds report the load imbalance of
+  // every call site
+  #define DOMP_SYNC { dompObject->Synchronize(__FILE__, __LINE__); }
+
+  // Split phase sync. With DOMP_PROGRESS_THREAD=1 in the environment the sync runs on a background thread between
+  // BEGIN and END, so computation on data not involved in it overlaps with the transfers. Requests made after BEGIN go
+  // with the next sync. Without the thread BEGIN does the whole sync
+  #define DOMP_SYNC_BEGIN { dompObject->SynchronizeBegin(__FILE__, __LINE__); }
+  #define DOMP_SYNC_END { dompObject->SynchronizeEnd(); }
 
-  #define DOMP_REDUCE(var, type, op) (dompObject->Reduce(#var, (void*)&(var), type, op))
+  #define DOMP_REDUCE(var, type, op) (dompObject->Reduce(#var, (void*)&(var), type, op, __FILE__, __LINE__))
 
   #define DOMP_ARRAY_REDUCE(var, type, op, offset, size) { \
-      dompObject->ArrayReduce(#var, var, type, op, offset, size, REDUCE_ON_MASTER); \
+      dompObject->ArrayReduce(#var, var, type, op, offset, size, REDUCE_ON_MASTER, __FILE__, __LINE__); \
   }
 
   #define DOMP_ARRAY_REDUCE_ALL(var, type, op, offset, size) { \
-        dompObject->ArrayReduce(#var, var, type, op, offset, size, REDUCE_ALL); \
+        dompObject->ArrayReduce(#var, var, type, op, offset, size, REDUCE_ALL, __FILE__, __LINE__); \
+  }
+
+  // Reductions done in the background, like DOMP_SYNC_BEGIN. The data must not be used before DOMP_REDUCE_END
+  #define DOMP_REDUCE_BEGIN(var, type, op) { \
+      dompObject->ArrayReduceBegin(#var, (void*)&(var), type, op, 0, 1, REDUCE_ON_MASTER, __FILE__, __LINE__); \
+  }
+
+  #define DOMP_ARRAY_REDUCE_BEGIN(var, type, op, offset, size) { \
+      dompObject->ArrayReduceBegin(#var, var, type, op, offset, size, REDUCE_ON_MASTER, __FILE__, __LINE__); \
+  }
+
+  #define DOMP_ARRAY_REDUCE_ALL_BEGIN(var, type, op, offset, size) { \
+      dompObject->ArrayReduceBegin(#var, var, type, op, offset, size, REDUCE_ALL, __FILE__, __LINE__); \
   }
 
+  // Waits for all the background reductions and syncs
+  #define DOMP_REDUCE_END { dompObject->WaitAsync(); }
+
   #define DOMP_FINALIZE() { \
     delete(dompObject); \
     dompObject = NULL; \
@@ -78,6 +358,19 @@ void log(const char *fmt, ...);
 
   #define DOMP_TIMER_INIT() { dompObject->InitProfiler();}
 
+  // Hardware counters of a named region of code on every node, reported at finalize. Enabled by DOMP_PERF=1 in the
+  // environment, a disabled region costs a pointer check. Regions are entered and left outside of parallel regions
+  #define DOMP_REGION_BEGIN(name) { if (domp::dompPerf != NULL) domp::PerfRegionBegin(name); }
+  #define DOMP_REGION_END(name) { if (domp::dompPerf != NULL) domp::PerfRegionEnd(name); }
+
+  // Region until the end of the enclosing scope, at most one per scope
+  #define DOMP_REGION(name) domp::PerfScope dompRegionScope(name)
+
+  // Adds the time until the end of the enclosing scope to the timer called name, at most one per scope. Can be used
+  // by several threads at once. The timers of every node are printed at finalize
+  #define DOMP_SCOPED_TIMER(name) domp::ScopedTimer dompScopedTimer(name)
+  #define DOMP_TIMER_STATS(name) (dompObject->GetTimerStats(name))
+
   #define DOMP_IS_MASTER (dompObject->IsMaster())
 }
 
@@ -96,33 +389,125 @@ class domp::Profiler {
 class domp::DOMP{
   int rank;
   int clusterSize;
+  int gridRows;
+  int gridCols;
   std::map<std::string, Variable*> varList;
   DataManager *dataManager;
+  WorkQueue *workQueue;
+  // Inputs of the dynamic loop and their granularity
+  std::vector<std::pair<std::string, int> > dynamicInputs;
+  DOMP_PARTITION_MODE partitionMode;
+  // Share of work for every node, used in adaptive mode
+  std::vector<double> partitionWeights;
+  // Work given to this node by last Parallelize and the compute time spent between syncs since then
+  int partitionRows;
+  double computeTime;
+  double lastSyncExit;
+  double intervalLibTime;
+  // The last adaptive Parallelize moved the weights, so exclusive requests also fetch until the next sync
+  bool migratePending;
+  // Layout of last Parallelize and Parallelize2D, halos are rebuilt when it changes
+  int layoutOffset;
+  int layoutSize;
+  int layoutTile[4];
+  int layoutVersion;
+  // Layout of DOMP_PARALLEL_FOR, for the total, mode and weights it was made with. Bumped when the weights change
+  int weightsVersion;
+  int forOffset;
+  int forSize;
+  int forTotal;
+  DOMP_PARTITION_MODE forMode;
+  int forWeightsVersion;
+  // NUMA node of every OpenMP thread, recorded in its first DOMP_PARALLEL_FOR. -1 until then
+  std::vector<int> threadNodes;
+  // DOMP_NUMA_THREADS=1, threads are kept on the cores of their NUMA node
+  bool numaThreads;
+  std::map<std::string, Halo*> haloList;
+  // Memory from Alloc, aligned address to the address returned by MPI_Alloc_mem
+  std::map<void*, void*> allocList;
   void *dataBuffer;
   int currentBufferSize;
+  // Runs the split phase syncs and reductions, NULL when disabled
+  ProgressThread *progressThread;
+  long syncTicket;
+  // Cores left for the application threads after binding, zero if the thread count is left alone
+  int appThreads;
 #if PROFILING
   Profiler profiler;
+  ImbalanceProfiler *imbalance;
+  // Event of the sync between SynchronizeBegin and SynchronizeEnd
+  int asyncSyncEvent;
+  // DOMP_REPORT=1 in the environment of the master
+  bool reportEnabled;
 #endif
   int getSizeBytes(const MPI_Datatype &type) const;
+  void getPartition(int totalSize, int node, int *offset, int *size) const;
+  // Whether the weights changed
+  bool updatePartitionWeights();
+  double libClock() const;
+  int getCols(std::string varName);
+  int reserveProgressCore();
+  void bindToCores(bool spareCore);
+  void endDynamic();
  public:
   DOMP(int * argc, char ***argv);
   ~DOMP();
   void Register(std::string varName, void* varValue, MPI_Datatype type, int size);
+  void Register2D(std::string varName, void* varValue, MPI_Datatype type, int rows, int cols);
+  void Unregister(std::string varName);
+  void *Alloc(std::string varName, MPI_Datatype type, int size, int cols = 0);
+  void Free(std::string varName, void *ptr);
+  void CreateGrid(int rows, int cols);
+  int GetGridRow();
+  int GetGridCol();
+  int GetGridRows();
+  int GetGridCols();
+  void Parallelize2D(int rows, int cols, int *rowOffset, int *rowSize, int *colOffset, int *colSize);
+  void SharedTile(std::string varName, int rowOffset, int rowSize, int colOffset, int colSize);
+  void ExclusiveTile(std::string varName, int rowOffset, int rowSize, int colOffset, int colSize);
+  void HaloExchange(std::string varName, int width, bool periodic);
+  void SetProtocol(std::string varName, DOMP_PROTOCOL protocol);
+  void SetChunkSize(int bytes);
+  void SetChunkHook(DOMP_CHUNK_HOOK hook, void *arg);
+  DOMPCommStats_t GetVariableStats(std::string varName);
+  DOMPCommStats_t GetPeerStats(int node);
+  DOMPCoherenceStats_t GetCoherenceStats(std::string varName);
+  DOMPTimerStats_t GetTimerStats(std::string name);
+  void SetPartitionMode(DOMP_PARTITION_MODE mode);
   void Parallelize(int totalSize, int *offset, int *size);
+  void Parallelize(int totalSize, int granularity, int alignment, int *offset, int *size);
+  void ParallelizeBlockCyclic(int totalSize, int blockSize, std::vector<std::pair<int, int> > *blocks);
+  void ParallelizeDynamic(int totalSize, int chunkSize);
+  void SharedDynamic(std::string varName, int granularity);
+  bool NextChunk(int *offset, int *size);
+  void ParallelizeFor(int totalSize, int maxThreads);
+  void SetThreadCpu(int thread, int cpu);
+  // Range of a thread in current DOMP_PARALLEL_FOR, returns its first index
+  int ThreadRange(int thread, int numThreads, int *end);
+  int GetForOffset();
+  int GetForSize();
+  void ExclusiveDynamic(std::string varName, int granularity);
   void FirstShared(std::string varName, int offset, int size);
   void Shared(std::string varName, int offset, int size);
   void Exclusive(std::string varName, int offset, int size);
-  void Reduce(std::string varName, void *address, MPI_Datatype type, MPI_Op op);
-  void Synchronize();
+  void Reduce(std::string varName, void *address, MPI_Datatype type, MPI_Op op, const char *file = NULL,
+              int line = 0);
+  void Synchronize(const char *file = NULL, int line = 0);
+  void SynchronizeBegin(const char *file = NULL, int line = 0);
+  void SynchronizeEnd();
+  void WaitAsync();
   bool IsMaster();
   int GetRank();
   int GetClusterSize();
+  int GetThreadCount();
 
   // These functions are used by DataManager
   std::pair<char *, int> mapDataRequest(char* varName, int start, int size);
   // For reduction
   void ArrayReduce(std::string varName, void *address, MPI_Datatype type, MPI_Op op, int offset, int size,
-    DOMP_REDUCE_TYPE reduceType);
+    DOMP_REDUCE_TYPE reduceType, const char *file = NULL, int line = 0);
+  void ArrayReduceBegin(std::string varName, void *address, MPI_Datatype type, MPI_Op op, int offset, int size,
+    DOMP_REDUCE_TYPE reduceType, const char *file = NULL, int line = 0);
 
   void PrintProfilingData();
   void InitProfiler();
@@ -133,11 +518,14 @@ class domp::Variable {
   char *ptr;
   MPI_Datatype type;
   int size;
+  // Number of columns for 2D variables, 0 otherwise
+  int cols;
  public:
-  Variable(char * ptr, MPI_Datatype type, int size) {
+  Variable(char * ptr, MPI_Datatype type, int size, int cols = 0) {
     this->ptr = ptr;
     this->type = type;
     this->size = size;
+    this->cols = cols;
   }
   char *getPtr() const {
     return ptr;
@@ -148,6 +536,50 @@ class domp::Variable {
   int getSize() const {
     return size;
   }
+  int getCols() const {
+    return cols;
+  }
+};
+
+class domp::PerfScope {
+  const char *name;
+ public:
+  PerfScope(const char *name) {
+    this->name = name;
+    if (dompPerf != NULL) PerfRegionBegin(name);
+  }
+
+  ~PerfScope() {
+    if (dompPerf != NULL) PerfRegionEnd(name);
+  }
 };
 
+class domp::ScopedTimer {
+  const char *name;
+  double start;
+ public:
+  ScopedTimer(const char *name) {
+    this->name = name;
+    start = currentSeconds();
+  }
+
+  ~ScopedTimer() {
+    if (dompTimers != NULL) RecordTimer(name, currentSeconds() - start);
+  }
+};
+
+#ifdef _OPENMP
+namespace domp {
+  // Called by every thread of the parallel region of DOMP_PARALLEL_FOR. All the threads must report their cpu before
+  // the ranges are known. Only the first report of a thread is used
+  inline int ThreadRange(int *end) {
+    int thread = omp_get_thread_num();
+    int numThreads = omp_get_num_threads();
+    dompObject->SetThreadCpu(thread, sched_getcpu());
+    DOMP_PRAGMA(omp barrier)
+    return dompObject->ThreadRange(thread, numThreads, end);
+  }
+}
+#endif
+
 #endif //DOMP_DOMP_H
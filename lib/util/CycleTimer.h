@@ -5,6 +5,8 @@
 #ifndef DOMP_CYCLETIMER_H
 #define DOMP_CYCLETIMER_H
 
+// Seconds from a monotonic clock, zero is at some arbitrary point in the past. Comparable between the threads of a
+// process, even after they migrate between cores
 double currentSeconds();
 
 #endif //DOMP_CYCLETIMER_H
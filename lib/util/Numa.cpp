@@ -0,0 +1,79 @@
+//
+// NUMA node and physical core of every cpu, read once from sysfs.
+//
+
+#include <stdio.h>
+#include <vector>
+#include "Numa.h"
+
+#define DOMP_MAX_NUMA_NODES (64)
+#define DOMP_MAX_CPUS (1024)
+
+namespace domp {
+  typedef struct NumaTopology {
+    std::vector<int> cpuNodes;
+    std::vector<int> cpuCores;
+    int numNodes;
+
+    // Every node lists its cpus as ranges, like 0-3,8-11
+    NumaTopology() {
+      numNodes = 1;
+      for (int node = 0; node < DOMP_MAX_NUMA_NODES; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) continue;
+        int first, last;
+        while (fscanf(file, "%d", &first) == 1) {
+          last = first;
+          int next = fgetc(file);
+          if (next == '-') {
+            if (fscanf(file, "%d", &last) != 1) break;
+            next = fgetc(file);
+          }
+          for (int cpu = first; cpu <= last; cpu++) {
+            if (cpu >= (int) cpuNodes.size()) cpuNodes.resize(cpu + 1, 0);
+            cpuNodes[cpu] = node;
+          }
+          if (next != ',') break;
+        }
+        fclose(file);
+        if (node + 1 > numNodes) numNodes = node + 1;
+      }
+      // Hardware threads of a core list the same siblings, the first one names the core
+      for (int cpu = 0; cpu < DOMP_MAX_CPUS; cpu++) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) continue;
+        int first;
+        if (fscanf(file, "%d", &first) == 1) {
+          if (cpu >= (int) cpuCores.size()) cpuCores.resize(cpu + 1, -1);
+          cpuCores[cpu] = first;
+        }
+        fclose(file);
+      }
+    }
+  } NumaTopology_t;
+
+  static const NumaTopology_t &getTopology() {
+    static NumaTopology_t topology;
+    return topology;
+  }
+
+  int GetNumaNode(int cpu) {
+    const NumaTopology_t &topology = getTopology();
+    if (cpu < 0 || cpu >= (int) topology.cpuNodes.size()) return 0;
+    return topology.cpuNodes[cpu];
+  }
+
+  int GetNumaNodeCount() {
+    return getTopology().numNodes;
+  }
+
+  int GetPhysicalCore(int cpu) {
+    const NumaTopology_t &topology = getTopology();
+    if (cpu < 0 || cpu >= (int) topology.cpuCores.size() || topology.cpuCores[cpu] < 0) return cpu;
+    return topology.cpuCores[cpu];
+  }
+}
@@ -0,0 +1,16 @@
+//
+// NUMA node and physical core of every cpu, read once from sysfs.
+//
+
+#ifndef DOMP_NUMA_H
+#define DOMP_NUMA_H
+
+namespace domp {
+  // Node 0 for unknown cpus, or when sysfs has no NUMA information
+  int GetNumaNode(int cpu);
+  int GetNumaNodeCount();
+  // Lowest cpu of the physical core, the same for all its hardware threads. The cpu itself when sysfs doesn't say
+  int GetPhysicalCore(int cpu);
+}
+
+#endif //DOMP_NUMA_H
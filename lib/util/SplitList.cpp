@@ -5,12 +5,14 @@
 #include <iostream>
 #include "SplitList.h"
 #include "../domp.h"
+#include "../DataManager.h"
 
 using namespace std;
 
 namespace domp {
-  SplitList::SplitList(int start, int size, int nodeId) {
-    fragments.InsertFront(new Fragment(start, size, nodeId));
+  SplitList::SplitList(int start, int size, int nodeId, int clusterSize) {
+    protocol = PROTOCOL_INVALIDATE;
+    fragments.InsertFront(new Fragment(start, size, nodeId, clusterSize));
   }
 
   SplitList::~SplitList() {
@@ -45,9 +47,9 @@ namespace domp {
       // Case 2: |X||
       if (start == current->start && end < current->end) {
         log("Found Case 2:: Required[%d, %d] Current[%d, %d]", start, end, current->start, current->end);
-        Fragment* nextNode = Split(current, end, nodeId, SPLIT_ACCESS(accessType), USE_FIRST);
-        if (nextNode != NULL && IS_FETCH(accessType)) {
-          CreateCommand(commandManager, nodeId, current, varName);
+        Split(current, end, nodeId, SPLIT_ACCESS(accessType), USE_FIRST);
+        if (IS_FETCH(accessType)) {
+          Fetch(commandManager, nodeId, current, varName);
         }
         break;
       }
@@ -56,11 +58,16 @@ namespace domp {
         // Same case for both Exclusive fetch and shared fetch
         log("Found Case 3:: Required[%d, %d] Current[%d, %d]", start, end, current->start, current->end);
         Fragment* nextNode = Split(current, start - 1, nodeId, SPLIT_ACCESS(accessType), USE_SECOND);
-        if (nextNode != NULL && IS_FETCH(accessType)) {
-          CreateCommand(commandManager, nodeId, nextNode, varName);
+        if (nextNode != NULL) {
+          if (IS_FETCH(accessType)) {
+            Fetch(commandManager, nodeId, nextNode, varName);
+          }
           start = nextNode->end + 1;
           current = nextNode;
         } else {
+          if (IS_FETCH(accessType)) {
+            Fetch(commandManager, nodeId, current, varName);
+          }
           start = current->end + 1;
         }
       }
@@ -73,20 +80,20 @@ namespace domp {
         Fragment* nextNode = Split(current, start - 1, nodeId, SPLIT_ACCESS(accessType), USE_SECOND);
         if (nextNode != NULL) {
           // Second Split using first. See last argument as true here.
-          Fragment* nextNextNode = Split(nextNode, end, nodeId, SPLIT_ACCESS(accessType), USE_FIRST);
-          if (nextNextNode != NULL && IS_FETCH(accessType)) {
-            CreateCommand(commandManager, nodeId, nextNode, varName);
+          Split(nextNode, end, nodeId, SPLIT_ACCESS(accessType), USE_FIRST);
+          if (IS_FETCH(accessType)) {
+            Fetch(commandManager, nodeId, nextNode, varName);
           }
+        } else if (IS_FETCH(accessType)) {
+          Fetch(commandManager, nodeId, current, varName);
         }
         break;
       }
       // Case 5: |X|
       else if (start == current->start && end >= current->end) {
         log("Found Case 5:: Required[%d, %d] Current[%d, %d]", start, end, current->start, current->end);
-        if (current->nodes.count(nodeId) == 0) {
-          if (IS_FETCH(accessType)) {
-            CreateCommand(commandManager, nodeId, current, varName);
-          }
+        if (IS_FETCH(accessType)) {
+          Fetch(commandManager, nodeId, current, varName);
         }
         // Update start
         start = current->end + 1;
@@ -105,7 +112,7 @@ namespace domp {
                              SplitListUseNode useNode) {
     if (accessType != EXCLUSIVE) {
       // If not exclusive and already have it, don't Split
-      if (current->nodes.count(nodeId) != 0) return NULL;
+      if (current->hasCurrent(nodeId)) return NULL;
     }
     // Create a copy of the fragment
     Fragment* fragment = new Fragment(current);
@@ -117,11 +124,47 @@ namespace domp {
   }
 
   void SplitList::CreateCommand(CommandManager *commandManager, int destination, Fragment *fragment, char* varName) {
-    // Logic from which node to fetch the data. We can distribute it to multiple nodes, if multiple nodes have the data
-    int source = *fragment->nodes.begin();
-    log("MASTER:: Created fetch command Var[%s], From[%d] TO[%d], Start[%d], Size[%d]", varName, source, destination,
-        fragment->start, fragment->size);
-    commandManager->InsertCommand(varName, fragment->start, fragment->size, source, destination);
+    // Any node with a current copy can serve the data, the one with the least to send in this sync is picked at merge
+    fragment->getSources(sources);
+    if (sources.empty()) {
+      log("MASTER:: No node has Var[%s] Start[%d], Size[%d] yet", varName, fragment->start, fragment->size);
+      return;
+    }
+    log("MASTER:: Created fetch command Var[%s], Sources[%d] TO[%d], Start[%d], Size[%d]", varName, (int) sources.size(),
+        destination, fragment->start, fragment->size);
+    commandManager->InsertFetch(varName, fragment->start, fragment->size, sources, destination);
+  }
+
+  // Fetch unless the node already has a current copy
+  void SplitList::Fetch(CommandManager *commandManager, int destination, Fragment *fragment, char* varName) {
+    if (fragment->hasCurrent(destination)) {
+      stats.hits++;
+      fragment->hit(destination);
+      return;
+    }
+    stats.misses++;
+    CreateCommand(commandManager, destination, fragment, varName);
+  }
+
+  // Update protocol. Push the fragments written in last phase to the nodes that had a copy before the write
+  void SplitList::PushPhase(CommandManager *commandManager, char* varName) {
+    if (protocol != PROTOCOL_UPDATE) return;
+    for (Fragment *current = fragments.begin(); current != NULL; current = current->next) {
+      for (int node = 0; node < current->numNodes(); node++) {
+        if (!current->isPending(node) || current->hasCurrent(node)) continue;
+        log("MASTER:: Pushing update Var[%s] to node %d, Start[%d], Size[%d]", varName, node, current->start,
+            current->size);
+        CreateCommand(commandManager, node, current, varName);
+        stats.updates++;
+        stats.updateElements += current->size;
+      }
+      // Only after all the commands, a node receiving the data in this phase can't be a source yet
+      for (int node = 0; node < current->numNodes(); node++) {
+        if (!current->isPending(node) || current->hasCurrent(node)) continue;
+        current->markPushed(node);
+      }
+      current->clearPending();
+    }
   }
 
   // This is the write phase. This is when the new nodeIds will be added and previous nodeIds will be deleted for
@@ -133,7 +176,6 @@ namespace domp {
     int nodeId = command->nodeId;
     MPIAccessType  accessType = command->accessType;
     char* varName = command->varName;
-    std::list<DOMPMapCommand_t*> commands;
 
     log("WritePhase::Start[%d], End[%d], NodeId[%d], VarName[%s]", start, end, nodeId, varName);
 
@@ -143,16 +185,23 @@ namespace domp {
       if (start == current->start && end >= current->end) {
         // TODO: We should do coalesce here
         if (IS_EXCLUSIVE(accessType)) {
-          current->nodes.clear();
+          current->clearOwners();
         }
-        if (current->nodes.count(nodeId) == 0) {
-          current->nodes.insert(nodeId);
+        // Only writes make the other copies stale
+        if (accessType == MPI_EXCLUSIVE_FIRST) {
+          current->write(nodeId, protocol, &stats);
+        }
+        if (!current->isOwner(nodeId)) {
+          current->addNode(nodeId);
           log("WritePhase::Inserted New Node for Start[%d], End[%d], NodeId[%d], VarName[%s]", start, end, nodeId, varName);
         }
         start = current->end + 1;
       }
       else if (start > current->end) {
         // Nothing to do
+      } else if (!IS_EXCLUSIVE(accessType) && current->hasCurrent(nodeId)) {
+        // Read phase didn't split as the node already has a current copy, and other requests may have split it since
+        start = current->end + 1;
       } else {
         std::cout<<"ERROR: This shouldn't have happened. Writephase, no interval found"<<std::endl;
         break;
@@ -7,7 +7,7 @@
 
 #include <list>
 #include <string>
-#include <set>
+#include <vector>
 #include "DoublyLinkedList.h"
 #include "../CommandManager.h"
 
@@ -24,11 +24,30 @@ namespace domp {
 #define IS_EXCLUSIVE(e) ((e == MPI_EXCLUSIVE_FETCH) ||(e == MPI_EXCLUSIVE_FIRST))
 #define IS_FETCH(e) ((e == MPI_SHARED_FETCH) || (e == MPI_EXCLUSIVE_FETCH))
 
+  class DirectoryEntry;
   class Fragment;
   template <typename T> class DoublyLinkedList;
 
   #define SPLIT_ACCESS(accessType) (IS_EXCLUSIVE(accessType)?EXCLUSIVE:SHARED)
 
+  // Coherence counters of one variable, DOMPCoherenceStats_t starting at zero
+  typedef struct CoherenceStats : public DOMPCoherenceStats {
+    CoherenceStats() {
+      invalidations = updates = updateElements = hits = misses = wasted = 0;
+    }
+  } CoherenceStats_t;
+
+  // Copy of a directory entry on one node
+  typedef struct NodeCopy {
+    // Version it last received, -1 if it never had one
+    int version;
+    // Owners always hold the current version
+    bool owner;
+    // Update protocol. Gets the next version pushed, and got a push it hasn't requested since
+    bool pending;
+    bool pushed;
+  } NodeCopy_t;
+
    class SplitList {
     private:
      Fragment* Split(Fragment *current,
@@ -37,43 +56,145 @@ namespace domp {
                      SplitListAccessType accessType,
                      SplitListUseNode useNode);
      void CreateCommand(CommandManager *commandManager, int destination, Fragment *fragment, char* varName);
+     void Fetch(CommandManager *commandManager, int destination, Fragment *fragment, char* varName);
      DoublyLinkedList<Fragment> fragments;
+     DOMP_PROTOCOL protocol;
+     CoherenceStats_t stats;
+     // Scratch of CreateCommand, kept between syncs
+     std::vector<int> sources;
     public:
-      SplitList(int start, int size, int nodeId);
+      SplitList(int start, int size, int nodeId, int clusterSize);
       ~SplitList();
       void ReadPhase(DOMPMapCommand_t *command, CommandManager *commandManager);
       void WritePhase(DOMPMapCommand_t *command);
+      void PushPhase(CommandManager *commandManager, char* varName);
+      void SetProtocol(DOMP_PROTOCOL protocol) {
+        this->protocol = protocol;
+      }
+      DOMP_PROTOCOL GetProtocol() const {
+        return protocol;
+      }
+      const CoherenceStats_t &GetStats() const {
+        return stats;
+      }
    };
 }
 
-class domp::Fragment {
+// Version and copies of an entry of the directory, shared by Fragment and Tile. Every node has a slot, at node + 1 so
+// that DOMP_INVALID_NODE has one too. Slots are sized for the cluster when the entry is created, and the phases of a
+// sync only change them in place
+class domp::DirectoryEntry {
+ protected:
+  // Bumped on every exclusive write. A node whose copy has the current version doesn't need to fetch it again
+  int version;
+  std::vector<NodeCopy_t> slots;
+
+  NodeCopy_t &slot(int nodeId) {
+    return slots[nodeId + 1];
+  }
+
+  const NodeCopy_t &slot(int nodeId) const {
+    return slots[nodeId + 1];
+  }
+
+ public:
+  // Geometry only, like the request rectangles of TileList
+  DirectoryEntry() {
+    version = 0;
+  }
+
+  DirectoryEntry(int nodeId, int clusterSize) {
+    NodeCopy_t empty = {-1, false, false, false};
+    version = 0;
+    slots.assign(clusterSize + 1, empty);
+    addNode(nodeId);
+  }
+
+  int numNodes() const {
+    return (int) slots.size() - 1;
+  }
+
+  void addNode(int nodeId) {
+    slot(nodeId).owner = true;
+    slot(nodeId).version = version;
+  }
+
+  bool isOwner(int nodeId) const {
+    return slot(nodeId).owner;
+  }
+
+  void clearOwners() {
+    for (unsigned int i = 0; i < slots.size(); i++) slots[i].owner = false;
+  }
+
+  bool hasCurrent(int nodeId) const {
+    return slot(nodeId).version == version;
+  }
+
+  // New version written by nodeId
+  void write(int nodeId, DOMP_PROTOCOL protocol, CoherenceStats_t *stats) {
+    for (int node = 0; node < numNodes(); node++) {
+      if (node == nodeId || !hasCurrent(node)) continue;
+      if (protocol == PROTOCOL_UPDATE) slot(node).pending = true;
+      else stats->invalidations++;
+    }
+    for (int node = 0; node < numNodes(); node++) {
+      if (slot(node).pushed) stats->wasted++;
+      slot(node).pushed = false;
+    }
+    version++;
+    slot(nodeId).version = version;
+  }
+
+  // A request found a current copy, so a push to the node was not wasted
+  void hit(int nodeId) {
+    slot(nodeId).pushed = false;
+  }
+
+  bool isPending(int nodeId) const {
+    return slot(nodeId).pending;
+  }
+
+  // Pushed in this sync. Only after all the commands of the entry, a node receiving the data can't be a source yet
+  void markPushed(int nodeId) {
+    addNode(nodeId);
+    slot(nodeId).pushed = true;
+  }
+
+  void clearPending() {
+    for (unsigned int i = 0; i < slots.size(); i++) slots[i].pending = false;
+  }
+
+  // Nodes with a current copy, any of them can serve the data
+  void getSources(std::vector<int> &sources) const {
+    sources.clear();
+    for (int node = 0; node < numNodes(); node++) {
+      if (hasCurrent(node)) sources.push_back(node);
+    }
+  }
+};
+
+class domp::Fragment : public domp::DirectoryEntry {
   int start;
   int size;
   int end;
-  std::set <int> nodes;
   friend class SplitList;
   friend class DoublyLinkedList<Fragment>;
   Fragment *next;
   Fragment *prev;
  public:
-  Fragment(int start, int size, int nodeId) {
+  Fragment(int start, int size, int nodeId, int clusterSize) : DirectoryEntry(nodeId, clusterSize) {
     this->start = start;
     this->size = size;
     this->end = start + size - 1; // Notice -1
     next = prev = NULL;
-    this->nodes.insert(nodeId);
   }
 
-  Fragment(Fragment *from) {
+  Fragment(Fragment *from) : DirectoryEntry(*from) {
     this->start = from->start;
     this->size = from->size;
     this->end = start + size -  1; // Notice -1
     next = prev = NULL;
-    this->nodes.insert(from->nodes.begin(), from->nodes.end());
-  }
-
-  void addNode(int nodeId) {
-    this->nodes.insert(nodeId);
   }
 
   void update(int start, int end) {
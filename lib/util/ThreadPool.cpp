@@ -0,0 +1,67 @@
+//
+// Fixed set of threads running the iterations of a parallel loop, used by the master to map variables in parallel.
+//
+
+#include "ThreadPool.h"
+
+namespace domp {
+  ThreadPool::ThreadPool(int numThreads) {
+    numTasks = nextTask = remainingTasks = 0;
+    generation = 0;
+    stopping = false;
+    for (int i = 1; i < numThreads; i++) {
+      workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+  }
+
+  ThreadPool::~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    workReady.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+  }
+
+  void ThreadPool::runTasks(std::unique_lock<std::mutex> &guard) {
+    while (nextTask < numTasks) {
+      int index = nextTask++;
+      guard.unlock();
+      task(index);
+      guard.lock();
+      if (--remainingTasks == 0) {
+        workDone.notify_all();
+      }
+    }
+  }
+
+  void ThreadPool::ParallelFor(int numTasks, std::function<void(int)> task) {
+    if (numTasks <= 0) return;
+    std::unique_lock<std::mutex> guard(lock);
+    this->task = task;
+    this->numTasks = numTasks;
+    nextTask = 0;
+    remainingTasks = numTasks;
+    generation++;
+    workReady.notify_all();
+    runTasks(guard);
+    while (remainingTasks > 0) {
+      workDone.wait(guard);
+    }
+  }
+
+  void ThreadPool::work() {
+    long seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      while (!stopping && generation == seen) {
+        workReady.wait(guard);
+      }
+      if (stopping) break;
+      seen = generation;
+      runTasks(guard);
+    }
+  }
+}
@@ -0,0 +1,45 @@
+//
+// Fixed set of threads running the iterations of a parallel loop, used by the master to map variables in parallel.
+//
+
+#ifndef DOMP_THREADPOOL_H
+#define DOMP_THREADPOOL_H
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace domp {
+  class ThreadPool;
+}
+
+class domp::ThreadPool {
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable workReady;
+  std::condition_variable workDone;
+  std::function<void(int)> task;
+  int numTasks;
+  int nextTask;
+  int remainingTasks;
+  // Bumped by every ParallelFor, so that workers wake up once per loop
+  long generation;
+  bool stopping;
+
+  void work();
+  // Runs iterations until there are none left to start
+  void runTasks(std::unique_lock<std::mutex> &guard);
+ public:
+  // The calling thread takes part in every loop, so numThreads - 1 workers are started
+  ThreadPool(int numThreads);
+  ~ThreadPool();
+  // Calls task(i) for every i in [0, numTasks) and returns once all of them are done. Not reentrant
+  void ParallelFor(int numTasks, std::function<void(int)> task);
+  int Size() const {
+    return workers.size() + 1;
+  }
+};
+
+#endif //DOMP_THREADPOOL_H
@@ -0,0 +1,172 @@
+//
+// Directory of a two dimensional variable. Same phases as SplitList, but the entries are rectangular tiles.
+//
+
+#include <iostream>
+#include <algorithm>
+#include "TileList.h"
+#include "../domp.h"
+#include "../DataManager.h"
+
+using namespace std;
+
+namespace domp {
+  TileList::TileList(int rows, int cols, int nodeId, int clusterSize) {
+    this->rows = rows;
+    this->cols = cols;
+    protocol = PROTOCOL_INVALIDATE;
+    tiles.InsertFront(new Tile(0, 0, rows, cols, nodeId, clusterSize));
+  }
+
+  TileList::~TileList() {
+    Tile *current = tiles.begin();
+    while(current != NULL) {
+      Tile *next = current->next;
+      delete(current);
+      current = next;
+    }
+  }
+
+  int TileList::GetRects(DOMPMapCommand_t *command, Tile *rects) {
+    if (command->size <= 0) return 0;
+    if (command->count > 1) {
+      // Tile request. Stride is always the number of columns of the variable
+      rects[0].update(command->start / cols, command->start % cols, command->count, command->size);
+      return 1;
+    }
+    // Contiguous range of row major data: partial first row, full rows and partial last row
+    int end = command->start + command->size - 1;
+    int firstRow = command->start / cols, firstCol = command->start % cols;
+    int lastRow = end / cols, lastCol = end % cols;
+    if (firstRow == lastRow) {
+      rects[0].update(firstRow, firstCol, 1, lastCol - firstCol + 1);
+      return 1;
+    }
+    int count = 0;
+    int fullStart = firstRow, fullEnd = lastRow;
+    if (firstCol != 0) {
+      rects[count++].update(firstRow, firstCol, 1, cols - firstCol);
+      fullStart++;
+    }
+    if (lastCol != cols - 1) {
+      rects[count++].update(lastRow, 0, 1, lastCol + 1);
+      fullEnd--;
+    }
+    if (fullStart <= fullEnd) {
+      rects[count++].update(fullStart, 0, fullEnd - fullStart + 1, cols);
+    }
+    return count;
+  }
+
+  // Cut the current tile so that it only covers its intersection with rect. Remaining parts are inserted after it.
+  void TileList::Split(Tile *current, Tile *rect) {
+    int top = std::max(current->row, rect->row);
+    int bottom = std::min(current->row + current->rows, rect->row + rect->rows);
+    int left = std::max(current->col, rect->col);
+    int right = std::min(current->col + current->cols, rect->col + rect->cols);
+    int currentBottom = current->row + current->rows;
+    int currentRight = current->col + current->cols;
+
+    if (currentBottom > bottom) {
+      tiles.InsertAfter(current, new Tile(current, bottom, current->col, currentBottom - bottom, current->cols));
+    }
+    if (currentRight > right) {
+      tiles.InsertAfter(current, new Tile(current, top, right, bottom - top, currentRight - right));
+    }
+    if (left > current->col) {
+      tiles.InsertAfter(current, new Tile(current, top, current->col, bottom - top, left - current->col));
+    }
+    if (top > current->row) {
+      tiles.InsertAfter(current, new Tile(current, current->row, current->col, top - current->row, current->cols));
+    }
+    current->update(top, left, bottom - top, right - left);
+  }
+
+  void TileList::CreateCommand(CommandManager *commandManager, int destination, Tile *tile, char *varName) {
+    tile->getSources(sources);
+    if (sources.empty()) {
+      log("MASTER:: No node has Var[%s] Tile[%d, %d, %d, %d] yet", varName, tile->row, tile->col, tile->rows,
+          tile->cols);
+      return;
+    }
+    log("MASTER:: Created tile fetch command Var[%s], Sources[%d] TO[%d], Tile[%d, %d, %d, %d]", varName,
+        (int) sources.size(), destination, tile->row, tile->col, tile->rows, tile->cols);
+    commandManager->InsertFetch(varName, tile->row * cols + tile->col, tile->cols, sources, destination, tile->rows,
+                                cols);
+  }
+
+  void TileList::Fetch(CommandManager *commandManager, int destination, Tile *tile, char *varName) {
+    if (tile->hasCurrent(destination)) {
+      stats.hits++;
+      tile->hit(destination);
+      return;
+    }
+    stats.misses++;
+    CreateCommand(commandManager, destination, tile, varName);
+  }
+
+  void TileList::PushPhase(CommandManager *commandManager, char *varName) {
+    if (protocol != PROTOCOL_UPDATE) return;
+    for (Tile *current = tiles.begin(); current != NULL; current = current->next) {
+      for (int node = 0; node < current->numNodes(); node++) {
+        if (!current->isPending(node) || current->hasCurrent(node)) continue;
+        CreateCommand(commandManager, node, current, varName);
+        stats.updates++;
+        stats.updateElements += (long) current->rows * current->cols;
+      }
+      for (int node = 0; node < current->numNodes(); node++) {
+        if (!current->isPending(node) || current->hasCurrent(node)) continue;
+        current->markPushed(node);
+      }
+      current->clearPending();
+    }
+  }
+
+  void TileList::ReadPhase(DOMPMapCommand_t *command, CommandManager *commandManager) {
+    Tile rects[3];
+    int numRects = GetRects(command, rects);
+    int nodeId = command->nodeId;
+    MPIAccessType accessType = command->accessType;
+
+    for (int i = 0; i < numRects; i++) {
+      log("TILE READPHASE::Tile[%d, %d, %d, %d], NodeId[%d], VarName[%s]", rects[i].row, rects[i].col, rects[i].rows,
+          rects[i].cols, nodeId, command->varName);
+      for (Tile *current = tiles.begin(); current != NULL; current = current->next) {
+        if (!current->intersects(rects[i])) continue;
+        // If not exclusive and already have it, don't Split
+        if (IS_EXCLUSIVE(accessType) || !current->hasCurrent(nodeId)) {
+          if (!current->inside(rects[i])) {
+            Split(current, &rects[i]);
+          }
+        }
+        if (IS_FETCH(accessType)) {
+          Fetch(commandManager, nodeId, current, command->varName);
+        }
+      }
+    }
+  }
+
+  void TileList::WritePhase(DOMPMapCommand_t *command) {
+    Tile rects[3];
+    int numRects = GetRects(command, rects);
+    int nodeId = command->nodeId;
+    MPIAccessType accessType = command->accessType;
+
+    for (int i = 0; i < numRects; i++) {
+      for (Tile *current = tiles.begin(); current != NULL; current = current->next) {
+        if (!current->intersects(rects[i])) continue;
+        if (current->inside(rects[i])) {
+          if (IS_EXCLUSIVE(accessType)) {
+            current->clearOwners();
+          }
+          if (accessType == MPI_EXCLUSIVE_FIRST) {
+            current->write(nodeId, protocol, &stats);
+          }
+          current->addNode(nodeId);
+        } else if (IS_EXCLUSIVE(accessType) || !current->hasCurrent(nodeId)) {
+          std::cout<<"ERROR: This shouldn't have happened. Tile Writephase, tile not split"<<std::endl;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,93 @@
+//
+// Directory of a two dimensional variable. Same phases as SplitList, but the entries are rectangular tiles.
+//
+
+#ifndef DOMP_TILELIST_H
+#define DOMP_TILELIST_H
+
+#include "DoublyLinkedList.h"
+#include "SplitList.h"
+#include "../CommandManager.h"
+
+using namespace std;
+
+namespace domp {
+  class Tile;
+  class TileList;
+}
+
+class domp::TileList {
+ private:
+  int rows;
+  int cols;
+  DoublyLinkedList<Tile> tiles;
+  // Number of rectangles a command covers. A 1D range on a 2D variable can need up to three
+  int GetRects(DOMPMapCommand_t *command, Tile *rects);
+  void Split(Tile *current, Tile *rect);
+  void CreateCommand(CommandManager *commandManager, int destination, Tile *tile, char *varName);
+  void Fetch(CommandManager *commandManager, int destination, Tile *tile, char *varName);
+  DOMP_PROTOCOL protocol;
+  CoherenceStats_t stats;
+  // Scratch of CreateCommand, kept between syncs
+  std::vector<int> sources;
+ public:
+  TileList(int rows, int cols, int nodeId, int clusterSize);
+  ~TileList();
+  void ReadPhase(DOMPMapCommand_t *command, CommandManager *commandManager);
+  void WritePhase(DOMPMapCommand_t *command);
+  void PushPhase(CommandManager *commandManager, char *varName);
+  void SetProtocol(DOMP_PROTOCOL protocol) {
+    this->protocol = protocol;
+  }
+  DOMP_PROTOCOL GetProtocol() const {
+    return protocol;
+  }
+  const CoherenceStats_t &GetStats() const {
+    return stats;
+  }
+};
+
+class domp::Tile : public domp::DirectoryEntry {
+  int row;
+  int col;
+  int rows;
+  int cols;
+  friend class TileList;
+  friend class DoublyLinkedList<Tile>;
+  Tile *next;
+  Tile *prev;
+ public:
+  Tile() {
+    row = col = rows = cols = 0;
+    next = prev = NULL;
+  }
+
+  Tile(int row, int col, int rows, int cols, int nodeId, int clusterSize) : DirectoryEntry(nodeId, clusterSize) {
+    update(row, col, rows, cols);
+    next = prev = NULL;
+  }
+
+  Tile(Tile *from, int row, int col, int rows, int cols) : DirectoryEntry(*from) {
+    update(row, col, rows, cols);
+    next = prev = NULL;
+  }
+
+  void update(int row, int col, int rows, int cols) {
+    this->row = row;
+    this->col = col;
+    this->rows = rows;
+    this->cols = cols;
+  }
+
+  bool intersects(const Tile &other) const {
+    return row < other.row + other.rows && other.row < row + rows &&
+           col < other.col + other.cols && other.col < col + cols;
+  }
+
+  bool inside(const Tile &other) const {
+    return row >= other.row && row + rows <= other.row + other.rows &&
+           col >= other.col && col + cols <= other.col + other.cols;
+  }
+};
+
+#endif //DOMP_TILELIST_H
@@ -33,7 +33,7 @@ filename="$suffix*.sh.o*"
 outputfile=$2
 
 columns="clusterSize,Master Lib Time,Master CompTime,Master Total Time,Slave Lib Time,Slave CompTime,
-Slave Total Time,Cluster Lib Time,Cluster CompTime,Cluster Total Time"
+Slave Total Time,Cluster Lib Time,Cluster CompTime,Cluster Total Time,GFLOPs"
 echo ${columns} > ${outputfile}
 
 for file in ${filename};do
@@ -56,9 +56,11 @@ for file in ${filename};do
     clusterComputationTime=$(echo "scale=3; ${clusterTotalTime} - ${clusterLibTime}" | bc)
 
     clusterSize=$(echo "${output}" | grep 'DOMP Cluster Size' | awk '{print $5}')
+    # Only printed by the matrix multiplication benchmark
+    gflops=$(echo "${output}" | grep 'DOMP SUMMA GFLOP/s' | awk '{print $5}')
 
     testString=${clusterSize}','${masterLibTime}','${masterComputationTime}','${masterTotalTime}','${slaveLibTime}',
-    '${slaveComputationTime}','${slaveTotalTime}','${clusterLibTime}','${clusterComputationTime}','${clusterTotalTime}
+    '${slaveComputationTime}','${slaveTotalTime}','${clusterLibTime}','${clusterComputationTime}','${clusterTotalTime}','${gflops}
     echo ${testString}
     echo ${testString} >> ${outputfile}
 done
\ No newline at end of file
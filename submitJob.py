@@ -70,11 +70,10 @@ NODE_LIST=`cat $PBS_NODEFILE `
 echo "Nodelist::$NODE_LIST"
 echo "NodeCount::$PBS_NP"
     ''');
-    scriptFile.write("# Configure to place threads on successive processors\n")
-    scriptFile.write("OMP_PLACES=cores\n")
-    scriptFile.write("OMP_PROC_BIND=close\n")
+    # OpenMP binding would place threads over all the cores of the machine, on top of the cores of other ranks
+    scriptFile.write("# DOMP_INIT binds every rank and its threads to its own cores\n")
     scriptFile.write("\n")
-    scriptFile.write("/opt/opt-openmpi/1.8.5rc1/bin/mpirun -np $PBS_NP -machinefile nodes.$PBS_JOBID --bind-to-core "
+    scriptFile.write("/opt/opt-openmpi/1.8.5rc1/bin/mpirun -np $PBS_NP -machinefile nodes.$PBS_JOBID --bind-to none "
                      "--oversubscribe -report-bindings %s\n" % argString)
     scriptFile.write("rm -f nodes.$PBS_JOBID\n")
     scriptFile.close()
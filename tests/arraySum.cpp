@@ -12,7 +12,7 @@ using namespace std;
 int compute(int total_size) {
   std::cout<<DOMP_NODE_ID<<" starting function"<<std::endl;
   int *arr = new int[total_size];
-  int i, offset, size;
+  int offset, size;
 
   DOMP_REGISTER(arr, MPI_INT, total_size);
   DOMP_PARALLELIZE(total_size, &offset, &size);
@@ -22,18 +22,14 @@ int compute(int total_size) {
   int sum = 0;
 
   std::cout<<DOMP_NODE_ID<<" starting computation"<<std::endl;
-  #pragma omp parallel
-  {
-    // Basic initialization of array
-    #pragma omp for
-    for (i = offset; i < (offset + size); i++)
-        arr[i] = i;
-    #pragma omp for reduction(+ : sum)
-      // Array sum
-      for(i=offset; i < (offset + size); i++) {
-        sum += arr[i];
-      }
-   }
+  // Basic initialization of array. Every thread touches first the part it sums later
+  DOMP_PARALLEL_FOR(i, total_size) {
+    arr[i] = i;
+  }
+  // Array sum
+  DOMP_PARALLEL_FOR(i, total_size, reduction(+ : sum)) {
+    sum += arr[i];
+  }
   std::cout<<DOMP_NODE_ID<<" Calling reduce now"<<std::endl;
   DOMP_REDUCE(sum, MPI_INT, MPI_SUM);
   return sum;
@@ -0,0 +1,81 @@
+//
+// Collatz step counts with DOMP_PARALLELIZE_DYNAMIC. The cost of an element varies a lot, so the nodes steal chunks
+// from each other. Inputs are written block cyclic, every node gets its own block before the loop and the inputs of
+// the chunks it steals in it. The master checks all the outputs
+//
+#include <iostream>
+
+#include "../lib/domp.h"
+#include <omp.h>
+
+using namespace domp;
+using namespace std;
+
+static int collatzSteps(long value) {
+  int steps = 0;
+  while (value > 1) {
+    value = (value % 2 == 0) ? value / 2 : 3 * value + 1;
+    steps++;
+  }
+  return steps;
+}
+
+int compute(int total_size, int chunk_size) {
+  int *seed = new int[total_size];
+  int *steps = new int[total_size];
+
+  DOMP_REGISTER(seed, MPI_INT, total_size);
+  DOMP_REGISTER(steps, MPI_INT, total_size);
+
+  // Inputs are written in round robin blocks, every block is declared on its own
+  std::vector<std::pair<int, int> > blocks;
+  DOMP_PARALLELIZE_CYCLIC(total_size, chunk_size, &blocks);
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    for (int i = blocks[b].first; i < blocks[b].first + blocks[b].second; i++) {
+      seed[i] = i + 1;
+    }
+    DOMP_EXCLUSIVE(seed, blocks[b].first, blocks[b].second);
+  }
+  DOMP_SYNC;
+
+  int sum = 0;
+  DOMP_PARALLELIZE_DYNAMIC(total_size, chunk_size);
+  DOMP_SHARED_DYNAMIC(seed, 1);
+  DOMP_SYNC;
+  int chunkOffset, chunkSize;
+  while (DOMP_NEXT_CHUNK(&chunkOffset, &chunkSize)) {
+    #pragma omp parallel for reduction(+ : sum) schedule(dynamic, 64)
+    for (int i = chunkOffset; i < chunkOffset + chunkSize; i++) {
+      steps[i] = collatzSteps(seed[i]);
+      sum += steps[i];
+    }
+  }
+  DOMP_EXCLUSIVE_DYNAMIC(steps, 1);
+  DOMP_SYNC;
+  DOMP_REDUCE(sum, MPI_INT, MPI_SUM);
+
+  // The master reads the outputs from the nodes that ran the chunks
+  if (DOMP_IS_MASTER) {
+    DOMP_SHARED(steps, 0, total_size);
+  }
+  DOMP_SYNC;
+  if (DOMP_IS_MASTER) {
+    int errors = 0;
+    for (int i = 0; i < total_size; i++) {
+      if (steps[i] != collatzSteps(i + 1)) errors++;
+    }
+    std::cout << "Dynamic verification " << (errors == 0 ? "passed" : "FAILED") << " (" << errors << " errors)"
+              << std::endl;
+  }
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  DOMP_INIT(&argc, &argv);
+  int sum = compute(1 << 20, 4096);
+  if (DOMP_IS_MASTER) {
+    std::cout << "Total steps " << sum << std::endl;
+  }
+  DOMP_FINALIZE();
+  return 0;
+}
@@ -0,0 +1,148 @@
+//
+// Integer stencils that only exchange ghost cells with DOMP_HALO, no syncs. A 1D one with fixed boundaries, the same
+// one with periodic boundaries, and a 5 point 2D one on the process grid. Every node checks its own block against a
+// sequential run
+//
+#include <iostream>
+#include <vector>
+
+#include "../lib/domp.h"
+#include <omp.h>
+
+using namespace domp;
+using namespace std;
+
+#define STENCIL_MOD 1000003
+
+// Cells outside the domain are zero, unless periodic
+int cell1D(const int *u, int n, int i, bool periodic) {
+  if (periodic) return u[(i + n) % n];
+  return (i < 0 || i >= n) ? 0 : u[i];
+}
+
+int step1D(const int *u, int n, int i, bool periodic) {
+  return (cell1D(u, n, i - 1, periodic) + 2 * u[i] + cell1D(u, n, i + 1, periodic)) % STENCIL_MOD;
+}
+
+int cell2D(const int *u, int rows, int cols, int r, int c, bool periodic) {
+  if (periodic) return u[((r + rows) % rows) * cols + (c + cols) % cols];
+  return (r < 0 || r >= rows || c < 0 || c >= cols) ? 0 : u[r * cols + c];
+}
+
+int step2D(const int *u, int rows, int cols, int r, int c, bool periodic) {
+  return (cell2D(u, rows, cols, r - 1, c, periodic) + cell2D(u, rows, cols, r + 1, c, periodic) +
+          cell2D(u, rows, cols, r, c - 1, periodic) + cell2D(u, rows, cols, r, c + 1, periodic) +
+          4 * u[r * cols + c]) % STENCIL_MOD;
+}
+
+int stencil1D(int n, int iterations, bool periodic) {
+  int *u = NULL;
+  int offset, size;
+  DOMP_ALLOC(u, MPI_INT, n);
+  DOMP_PARALLELIZE(n, &offset, &size);
+  std::vector<int> next(n);
+
+  DOMP_PARALLEL_FOR(i, n) {
+    u[i] = (int) (((long) i * 7919) % STENCIL_MOD);
+  }
+  for (int it = 0; it < iterations; it++) {
+    // Ghost cells of this step are the edges the neighbours wrote in the last one
+    if (periodic) {
+      DOMP_HALO_PERIODIC(u, 1);
+    } else {
+      DOMP_HALO(u, 1);
+    }
+    DOMP_PARALLEL_FOR(i, n) {
+      next[i] = step1D(u, n, i, periodic);
+    }
+    DOMP_PARALLEL_FOR(i, n) {
+      u[i] = next[i];
+    }
+  }
+
+  std::vector<int> reference(n), referenceNext(n);
+  for (int i = 0; i < n; i++) reference[i] = (int) (((long) i * 7919) % STENCIL_MOD);
+  for (int it = 0; it < iterations; it++) {
+    for (int i = 0; i < n; i++) referenceNext[i] = step1D(&reference[0], n, i, periodic);
+    reference.swap(referenceNext);
+  }
+  int errors = 0;
+  for (int i = offset; i < offset + size; i++) {
+    if (u[i] != reference[i]) errors++;
+  }
+  DOMP_FREE(u);
+  return errors;
+}
+
+int stencil2D(int rows, int cols, int iterations, bool periodic) {
+  int *grid = NULL;
+  int rowOffset, rowSize, colOffset, colSize;
+  DOMP_ALLOC_2D(grid, MPI_INT, rows, cols);
+  DOMP_PARALLELIZE_2D(rows, cols, &rowOffset, &rowSize, &colOffset, &colSize);
+  std::vector<int> next((long) rows * cols);
+
+  for (int r = rowOffset; r < rowOffset + rowSize; r++) {
+    for (int c = colOffset; c < colOffset + colSize; c++) {
+      grid[r * cols + c] = (r * 131 + c * 7919) % STENCIL_MOD;
+    }
+  }
+  for (int it = 0; it < iterations; it++) {
+    if (periodic) {
+      DOMP_HALO_PERIODIC(grid, 1);
+    } else {
+      DOMP_HALO(grid, 1);
+    }
+    #pragma omp parallel for
+    for (int r = rowOffset; r < rowOffset + rowSize; r++) {
+      for (int c = colOffset; c < colOffset + colSize; c++) {
+        next[r * cols + c] = step2D(grid, rows, cols, r, c, periodic);
+      }
+    }
+    #pragma omp parallel for
+    for (int r = rowOffset; r < rowOffset + rowSize; r++) {
+      for (int c = colOffset; c < colOffset + colSize; c++) {
+        grid[r * cols + c] = next[r * cols + c];
+      }
+    }
+  }
+
+  std::vector<int> reference((long) rows * cols), referenceNext((long) rows * cols);
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cols; c++) reference[r * cols + c] = (r * 131 + c * 7919) % STENCIL_MOD;
+  }
+  for (int it = 0; it < iterations; it++) {
+    for (int r = 0; r < rows; r++) {
+      for (int c = 0; c < cols; c++) referenceNext[r * cols + c] = step2D(&reference[0], rows, cols, r, c, periodic);
+    }
+    reference.swap(referenceNext);
+  }
+  int errors = 0;
+  for (int r = rowOffset; r < rowOffset + rowSize; r++) {
+    for (int c = colOffset; c < colOffset + colSize; c++) {
+      if (grid[r * cols + c] != reference[r * cols + c]) errors++;
+    }
+  }
+  DOMP_FREE(grid);
+  return errors;
+}
+
+int main(int argc, char **argv) {
+  DOMP_INIT(&argc, &argv);
+  DOMP_GRID(0, 0);
+  const char *names[] = {"1D", "1D periodic", "2D", "2D periodic"};
+  int errors[4];
+  errors[0] = stencil1D(1000000, 20, false);
+  errors[1] = stencil1D(1000000, 20, true);
+  errors[2] = stencil2D(600, 480, 20, false);
+  errors[3] = stencil2D(600, 480, 20, true);
+  for (int i = 0; i < 4; i++) {
+    int stencilErrors = errors[i];
+    DOMP_REDUCE(stencilErrors, MPI_INT, MPI_SUM);
+    if (DOMP_IS_MASTER) {
+      std::cout << names[i] << " stencil " << (stencilErrors == 0 ? "verification passed" : "verification FAILED")
+                << " (" << stencilErrors << " errors)" << std::endl;
+    }
+  }
+  DOMP_FINALIZE();
+  return 0;
+}
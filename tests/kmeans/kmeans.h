@@ -46,8 +46,6 @@ float* file_read(int, char*, int*, int*);
 int     file_write(char*, int, int, int, float*, int*);
 
 
-double  wtime(void);
-
 extern int _debug;
 
 #endif
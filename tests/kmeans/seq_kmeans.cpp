@@ -156,6 +156,15 @@ float* seq_kmeans(float *objects,      /* in: [numObjs * numCoords] */
     do {
         delta = 0.0;
 
+        /* re-partition now and then, in adaptive mode the nodes that ran faster get more objects. The first sync after
+           it moves the memberships of the objects that changed node */
+        if (loop > 0 && loop % 500 == 0) {
+            DOMP_PARALLELIZE(numObjs, &offset, &size);
+            DOMP_SHARED(objects, offset * numCoords, size * numCoords);
+            DOMP_EXCLUSIVE(membership, offset, size);
+            DOMP_SYNC;
+        }
+
         for (i = offset; i < offset + size; i++) {
             /* find the array index of nestest cluster center */
             index = find_nearest_cluster(numClusters, numCoords, &objects[i * numCoords], clusters);
@@ -122,7 +122,7 @@ int main(int argc, char **argv) {
         goto done;
       }
 
-      if (is_output_timing) io_timing = wtime();
+      if (is_output_timing) io_timing = currentSeconds();
     }
 
     // This is for sharing among all nodes
@@ -137,7 +137,7 @@ int main(int argc, char **argv) {
         if (objects == NULL) exit(1);
 
         if (is_output_timing) {
-            timing = wtime();
+            timing = currentSeconds();
             io_timing = timing - io_timing;
             clustering_timing = timing;
         }
@@ -181,7 +181,7 @@ int main(int argc, char **argv) {
     if(DOMP_IS_MASTER) {
 
         if (is_output_timing) {
-            timing = wtime();
+            timing = currentSeconds();
             clustering_timing = timing - clustering_timing;
         }
 
@@ -195,7 +195,7 @@ int main(int argc, char **argv) {
 
     /*---- output performance numbers ---------------------------------------*/
     if (DOMP_IS_MASTER && is_output_timing) {
-        io_timing += wtime() - timing;
+        io_timing += currentSeconds() - timing;
         printf("\nPerforming **** Regular Kmeans (sequential version) ****\n");
 
         printf("Input file:     %s\n", filename);
@@ -176,21 +176,23 @@ void test_lr(char *inFile, char *lFile) {
     // construct LogisticRegression
     LogisticRegression classifier(train_N, n_in, n_out);
 
-    int offset, size;
+    int xOffset, xSize, yOffset, ySize;
 
     DOMP_REGISTER(train_X, MPI_INT, train_N * n_in);
     DOMP_REGISTER(train_Y, MPI_INT, train_N * n_out);
-    DOMP_PARALLELIZE(train_N, &offset, &size);
+    // Same rows for both arrays, so no extra alignment
+    DOMP_PARALLELIZE_ALIGNED(train_N, n_in, 1, &xOffset, &xSize);
+    DOMP_PARALLELIZE_ALIGNED(train_N, n_out, 1, &yOffset, &ySize);
 
-    DOMP_EXCLUSIVE(train_X, offset * 6, size * 6);
-    DOMP_EXCLUSIVE(train_Y, offset * 2, size * 2);
+    DOMP_EXCLUSIVE(train_X, xOffset, xSize);
+    DOMP_EXCLUSIVE(train_Y, yOffset, ySize);
     DOMP_SYNC;
 
     // train online
     for(int epoch=0; epoch<n_epochs; epoch++) {
 
-        for(int i=offset; i<offset+size; i++) {
-            classifier.train(&train_X[6*i], &train_Y[2*i], learning_rate);
+        for(int x=xOffset, y=yOffset; x<xOffset+xSize; x+=n_in, y+=n_out) {
+            classifier.train(&train_X[x], &train_Y[y], learning_rate);
         }
 
         DOMP_ARRAY_REDUCE_ALL(classifier.W_temp, MPI_DOUBLE, MPI_SUM, 0, n_in * n_out);
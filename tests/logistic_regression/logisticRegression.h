@@ -24,5 +24,3 @@ public:
     void softmax(double*);
     void predict(int*, double*);
 };
-
-double  wtime(void);
@@ -2,6 +2,7 @@
 #include <string>
 #include <math.h>
 #include "logisticRegression.h"
+#include "../../lib/util/CycleTimer.h"
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -178,7 +179,7 @@ void test_lr(char *inFile, char *lFile) {
         cout << "Error in opening label file" << endl;
     }
 
-    double start = wtime();
+    double start = currentSeconds();
 
 
     // training data
@@ -222,7 +223,7 @@ void test_lr(char *inFile, char *lFile) {
         }
     }
 
-    double stop = wtime();
+    double stop = currentSeconds();
     double duration = stop - start;
     cout << "Total time is: ";
     cout << duration << endl;
@@ -1,40 +0,0 @@
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-/*   File:         wtime.c                                                   */
-/*   Description:  a timer that reports the current wall time                */
-/*                                                                           */
-/*   Author:  Wei-keng Liao                                                  */
-/*            ECE Department Northwestern University                         */
-/*            email: wkliao@ece.northwestern.edu                             */
-/*   Copyright, 2005, Wei-keng Liao                                          */
-/*                                                                           */
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-
-#include <sys/time.h>
-#include <stdio.h>
-#include <stdlib.h>
-
-double wtime(void) 
-{
-    double          now_time;
-    struct timeval  etstart;
-    struct timezone tzp;
-
-    if (gettimeofday(&etstart, &tzp) == -1)
-        perror("Error: calling gettimeofday() not successful.\n");
-
-    now_time = ((double)etstart.tv_sec) +              /* in seconds */
-               ((double)etstart.tv_usec) / 1000000.0;  /* in microseconds */
-    return now_time;
-}
-
-#ifdef _TESTING_
-int main(int argc, char **argv) {
-    double time;
-
-    time = wtime();
-    printf("time of day = %10.4f\n", time);
-
-    return 0;
-}
-#endif
-
@@ -0,0 +1,173 @@
+/*
+    summa.cpp: distributed matrix multiplication (SUMMA) on DOMP
+
+    C = A x B for square N x N float matrices. Every matrix is split in 2D blocks over the DOMP process grid. At every
+    step k, each node fetches the k-th column panel of A for its block rows and the k-th row panel of B for its block
+    columns, then adds their product to its own block of C.
+*/
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>     /* getopt() */
+#include <omp.h>
+#include "../../../lib/domp.h"
+
+using namespace domp;
+using namespace std;
+
+// Cache blocking of the local kernel
+#define SUMMA_BLOCK_I (64)
+#define SUMMA_BLOCK_J (256)
+#define SUMMA_BLOCK_K (128)
+
+static inline float valueA(int i, int j) {
+    return (float) ((i * 7 + j * 3) % 17) / 17.0f;
+}
+
+static inline float valueB(int i, int j) {
+    return (float) ((i * 5 + j * 11) % 13) / 13.0f;
+}
+
+/*
+ * C[rows x cols] += A[rows x depth] * B[depth x cols] for sub matrices of row major N x N matrices. Blocked for cache,
+ * the innermost loop runs over contiguous columns of B and C and is vectorized.
+ */
+static void localMultiply(const float *A, const float *B, float *C, int N,
+                          int rowOffset, int rows, int colOffset, int cols, int kOffset, int depth) {
+    #pragma omp parallel for schedule(static)
+    for (int ii = rowOffset; ii < rowOffset + rows; ii += SUMMA_BLOCK_I) {
+        int iEnd = min(ii + SUMMA_BLOCK_I, rowOffset + rows);
+        for (int kk = kOffset; kk < kOffset + depth; kk += SUMMA_BLOCK_K) {
+            int kEnd = min(kk + SUMMA_BLOCK_K, kOffset + depth);
+            for (int jj = colOffset; jj < colOffset + cols; jj += SUMMA_BLOCK_J) {
+                int jEnd = min(jj + SUMMA_BLOCK_J, colOffset + cols);
+                for (int i = ii; i < iEnd; i++) {
+                    float *c = &C[(long) i * N];
+                    for (int k = kk; k < kEnd; k++) {
+                        const float a = A[(long) i * N + k];
+                        const float *b = &B[(long) k * N];
+                        #pragma omp simd
+                        for (int j = jj; j < jEnd; j++) {
+                            c[j] += a * b[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static int verify(const float *C, int N, int rowOffset, int rows, int colOffset, int cols) {
+    int errors = 0;
+    // Check a few entries of own block against a direct dot product
+    for (int s = 0; s < 16 && rows > 0 && cols > 0; s++) {
+        int i = rowOffset + (s * 7919) % rows;
+        int j = colOffset + (s * 104729) % cols;
+        double expected = 0;
+        for (int k = 0; k < N; k++) expected += (double) valueA(i, k) * valueB(k, j);
+        if (fabs(expected - C[(long) i * N + j]) > 1e-3 * fabs(expected) + 1e-3) errors++;
+    }
+    return errors;
+}
+
+/*---< usage() >------------------------------------------------------------*/
+static void usage(char *argv0) {
+    const char *help =
+      "Usage: %s [switches]\n"
+      "       -n size        : dimension of the square matrices (default 2048)\n"
+      "       -b size        : panel width of each step (default 128)\n"
+      "       -v             : verify the result\n";
+    fprintf(stderr, help, argv0);
+}
+
+int main(int argc, char **argv) {
+    DOMP_INIT(&argc, &argv);
+    int opt;
+    int N = 2048;
+    int panel = 128;
+    int isVerify = 0;
+
+    while ((opt = getopt(argc, argv, "n:b:v")) != EOF) {
+        switch (opt) {
+            case 'n': N = atoi(optarg);
+            break;
+            case 'b': panel = atoi(optarg);
+            break;
+            case 'v': isVerify = 1;
+            break;
+            default: usage(argv[0]);
+            break;
+        }
+    }
+    if (N <= 0 || panel <= 0) {
+        usage(argv[0]);
+        DOMP_FINALIZE();
+        return 1;
+    }
+
+    float *A, *B, *C;
+    DOMP_GRID(0, 0);
+    DOMP_ALLOC_2D(A, MPI_FLOAT, N, N);
+    DOMP_ALLOC_2D(B, MPI_FLOAT, N, N);
+    DOMP_ALLOC_2D(C, MPI_FLOAT, N, N);
+
+    int rowOffset, rowSize, colOffset, colSize;
+    DOMP_PARALLELIZE_2D(N, N, &rowOffset, &rowSize, &colOffset, &colSize);
+
+    // Initialize own blocks
+    #pragma omp parallel for schedule(static)
+    for (int i = rowOffset; i < rowOffset + rowSize; i++) {
+        for (int j = colOffset; j < colOffset + colSize; j++) {
+            A[(long) i * N + j] = valueA(i, j);
+            B[(long) i * N + j] = valueB(i, j);
+            C[(long) i * N + j] = 0;
+        }
+    }
+    DOMP_EXCLUSIVE_TILE(A, rowOffset, rowSize, colOffset, colSize);
+    DOMP_EXCLUSIVE_TILE(B, rowOffset, rowSize, colOffset, colSize);
+    DOMP_EXCLUSIVE_TILE(C, rowOffset, rowSize, colOffset, colSize);
+    DOMP_SYNC;
+
+    DOMP_TIMER_INIT();
+    double start = MPI_Wtime();
+
+    for (int k = 0; k < N; k += panel) {
+        int depth = min(panel, N - k);
+        // Column panel of A along the grid row and row panel of B along the grid column
+        DOMP_SHARED_TILE(A, rowOffset, rowSize, k, depth);
+        DOMP_SHARED_TILE(B, k, depth, colOffset, colSize);
+        // C is written again after this sync
+        DOMP_EXCLUSIVE_TILE(C, rowOffset, rowSize, colOffset, colSize);
+        DOMP_SYNC;
+        DOMP_REGION_BEGIN("localMultiply");
+        localMultiply(A, B, C, N, rowOffset, rowSize, colOffset, colSize, k, depth);
+        DOMP_REGION_END("localMultiply");
+    }
+
+    double elapsed = MPI_Wtime() - start;
+    DOMP_ARRAY_REDUCE(&elapsed, MPI_DOUBLE, MPI_MAX, 0, 1);
+
+    int errors = 0;
+    if (isVerify) {
+        errors = verify(C, N, rowOffset, rowSize, colOffset, colSize);
+        DOMP_ARRAY_REDUCE(&errors, MPI_INT, MPI_SUM, 0, 1);
+    }
+
+    if (DOMP_IS_MASTER) {
+        double gflops = 2.0 * N * N * (double) N / elapsed / 1e9;
+        printf("SUMMA N = %d, panel = %d, grid = %d x %d\n", N, panel, DOMP_GRID_ROWS, DOMP_GRID_COLS);
+        printf("SUMMA time = %10.4f sec\n", elapsed);
+        printf("DOMP SUMMA GFLOP/s = %10.4f\n", gflops);
+        if (isVerify) {
+            printf("SUMMA verification %s (%d errors)\n", errors == 0 ? "passed" : "FAILED", errors);
+        }
+    }
+
+    DOMP_FREE(A);
+    DOMP_FREE(B);
+    DOMP_FREE(C);
+    DOMP_FINALIZE();
+    return 0;
+}
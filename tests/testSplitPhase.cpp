@@ -0,0 +1,96 @@
+//
+// Split phase syncs and reductions on a ring of blocks. Run with DOMP_PROGRESS_THREAD=1 in the environment to overlap
+// them with the computation. Every iteration a node sums its old block while the sync fetches the next block, adds the
+// next block to its own, and sums the new block while the sum of the old blocks is reduced. Every node checks its
+// block and its new sum against a sequential run, and the master checks the reduced sums. Exits with 1 on a mismatch
+//
+#include <iostream>
+#include <vector>
+
+#include "../lib/domp.h"
+#include <omp.h>
+
+using namespace domp;
+using namespace std;
+
+// Small enough that the sums fit in an int
+#define VALUE_MOD 1009
+
+int compute(int total_size, int iterations) {
+  int *arr = new int[total_size];
+  int offset, size;
+
+  DOMP_REGISTER(arr, MPI_INT, total_size);
+  DOMP_PARALLELIZE(total_size, &offset, &size);
+
+  DOMP_PARALLEL_FOR(i, total_size) {
+    arr[i] = i % VALUE_MOD;
+  }
+  std::vector<int> reference(total_size), referenceNext(total_size);
+  for (int i = 0; i < total_size; i++) reference[i] = i % VALUE_MOD;
+
+  DOMP_EXCLUSIVE(arr, offset, size);
+  DOMP_SYNC;
+
+  int errors = 0;
+  int nextOffset = ((offset + size) >= total_size)?0:offset+size;
+  for(int it = 0; it < iterations; it++) {
+    int oldSum = 0;
+    DOMP_EXCLUSIVE(arr, offset, size);
+    // Fetch the data from neighbour
+    DOMP_SHARED(arr, nextOffset, size);
+    DOMP_SYNC_BEGIN;
+    // Own values are only read by the other nodes during the sync
+    DOMP_PARALLEL_FOR(i, total_size, reduction(+ : oldSum)) {
+      oldSum += arr[i];
+    }
+    DOMP_SYNC_END;
+    DOMP_PARALLEL_FOR(i, total_size) {
+      arr[i] = (arr[i] + arr[(i + size) % total_size]) % VALUE_MOD;
+    }
+    // The old sums are reduced in the background while the new block is summed
+    DOMP_REDUCE_BEGIN(oldSum, MPI_INT, MPI_SUM);
+    int newSum = 0;
+    DOMP_PARALLEL_FOR(i, total_size, reduction(+ : newSum)) {
+      newSum += arr[i];
+    }
+    DOMP_REDUCE_END;
+
+    int referenceOldSum = 0, referenceNewSum = 0;
+    for (int i = 0; i < total_size; i++) {
+      referenceOldSum += reference[i];
+      referenceNext[i] = (reference[i] + reference[(i + size) % total_size]) % VALUE_MOD;
+    }
+    reference.swap(referenceNext);
+    for (int i = offset; i < offset + size; i++) {
+      if (arr[i] != reference[i]) errors++;
+      referenceNewSum += reference[i];
+    }
+    if (newSum != referenceNewSum) errors++;
+    if (DOMP_IS_MASTER && oldSum != referenceOldSum) errors++;
+  }
+  delete[] arr;
+  return errors;
+}
+
+int main(int argc, char **argv) {
+  DOMP_INIT(&argc, &argv);
+  // Divisible by every cluster size up to 16, so that all the blocks have the same size
+  int totalSize = 720720;
+  int errors = 0;
+  if (totalSize % DOMP_CLUSTER_SIZE != 0) {
+    std::cout<<"Please run this program with a cluster size that divides "<<totalSize<<std::endl;
+    errors = 1;
+  } else {
+    errors = compute(totalSize, 24);
+  }
+  int totalErrors = errors;
+  DOMP_REDUCE(totalErrors, MPI_INT, MPI_SUM);
+  if (DOMP_IS_MASTER) {
+    std::cout << "Split phase " << (totalErrors == 0 ? "verification passed" : "verification FAILED") << " ("
+              << totalErrors << " errors)" << std::endl;
+    errors = totalErrors;
+  }
+  DOMP_FINALIZE();
+  return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+//
+// Update protocol on a ring of blocks. Every iteration a node adds the block of the next node to its own, and the last
+// node switches arr to the update protocol halfway. Every node checks its block against a sequential run after every
+// iteration. The master checks that the invalidate half missed on every read, and that after the switch the writes
+// are pushed to the readers, so only the first iteration misses. Exits with 1 on a mismatch
+//
+#include <iostream>
+#include <vector>
+
+#include "../lib/domp.h"
+#include <omp.h>
+
+using namespace domp;
+using namespace std;
+
+#define VALUE_MOD 1000003
+
+void printCoherence(const char *protocol, DOMPCoherenceStats_t stats) {
+  std::cout << protocol << ": hits " << stats.hits << ", misses " << stats.misses << ", invalidations "
+            << stats.invalidations << ", updates " << stats.updates << ", wasted " << stats.wasted << std::endl;
+}
+
+// Coherence counters of both halves, on the master
+int checkCoherence(DOMPCoherenceStats_t before, DOMPCoherenceStats_t after, int iterations) {
+  int errors = 0;
+  int clusterSize = DOMP_CLUSTER_SIZE;
+  if (clusterSize == 1) {
+    // Nobody else reads or writes the blocks
+    if (after.misses != 0 || after.updates != 0) errors++;
+    return errors;
+  }
+  long missesBefore = before.misses;
+  long missesAfter = after.misses - before.misses;
+  // One read of the next block per node and iteration
+  if (missesBefore != (long) clusterSize * (iterations / 2)) errors++;
+  if (before.updates != 0) errors++;
+  // The writes of the iteration before the switch were not pushed yet
+  if (missesAfter > clusterSize || missesAfter >= missesBefore) errors++;
+  if (after.updates <= 0 || after.hits - before.hits <= 0) errors++;
+  return errors;
+}
+
+int compute(int total_size, int iterations) {
+  int *arr = new int[total_size];
+  int i, offset, size;
+
+  DOMP_REGISTER(arr, MPI_INT, total_size);
+  DOMP_PARALLELIZE(total_size, &offset, &size);
+
+  for (i = offset; i < (offset + size); i++)
+    arr[i] = i % VALUE_MOD;
+  std::vector<int> reference(total_size), referenceNext(total_size);
+  for (i = 0; i < total_size; i++)
+    reference[i] = i % VALUE_MOD;
+
+  DOMP_EXCLUSIVE(arr, offset, size);
+  DOMP_SYNC;
+
+  int errors = 0;
+  DOMPCoherenceStats_t before = DOMP_COHERENCE_STATS(arr);
+  int nextOffset = ((offset + size) >= total_size)?0:offset+size;
+  for(int it = 0; it < iterations; it++) {
+    if (it == iterations / 2) {
+      before = DOMP_COHERENCE_STATS(arr);
+      if (DOMP_NODE_ID == DOMP_CLUSTER_SIZE - 1) {
+        DOMP_SET_PROTOCOL(arr, PROTOCOL_UPDATE);
+      }
+    }
+    DOMP_EXCLUSIVE(arr, offset, size);
+    // Fetch the data from neighbour, or have it pushed after the switch
+    DOMP_SHARED(arr, nextOffset, size);
+    DOMP_SYNC;
+    #pragma omp parallel for
+    for (i = offset; i < (offset + size); i++) {
+      arr[i] = (arr[i] + arr[(i + size) % total_size]) % VALUE_MOD;
+    }
+
+    for (i = 0; i < total_size; i++)
+      referenceNext[i] = (reference[i] + reference[(i + size) % total_size]) % VALUE_MOD;
+    reference.swap(referenceNext);
+    for (i = offset; i < (offset + size); i++) {
+      if (arr[i] != reference[i]) errors++;
+    }
+  }
+
+  if (DOMP_IS_MASTER) {
+    DOMPCoherenceStats_t after = DOMP_COHERENCE_STATS(arr);
+    printCoherence("Invalidate", before);
+    printCoherence("Update", after);
+    errors += checkCoherence(before, after, iterations);
+  }
+  delete[] arr;
+  return errors;
+}
+
+int main(int argc, char **argv) {
+  DOMP_INIT(&argc, &argv);
+  // Divisible by every cluster size up to 16, so that all the blocks have the same size
+  int totalSize = 720720;
+  int errors = 0;
+  if (totalSize % DOMP_CLUSTER_SIZE != 0) {
+    std::cout<<"Please run this program with a cluster size that divides "<<totalSize<<std::endl;
+    errors = 1;
+  } else {
+    errors = compute(totalSize, 24);
+  }
+  int totalErrors = errors;
+  DOMP_REDUCE(totalErrors, MPI_INT, MPI_SUM);
+  if (DOMP_IS_MASTER) {
+    std::cout << "Update protocol " << (totalErrors == 0 ? "verification passed" : "verification FAILED") << " ("
+              << totalErrors << " errors)" << std::endl;
+    errors = totalErrors;
+  }
+  DOMP_FINALIZE();
+  return errors == 0 ? 0 : 1;
+}